@@ -116,14 +116,17 @@ void yield(void);
   #define INTERNAL 3
 
 // 8 series
-#elif defined(__AVR_ATmega48__) || defined(__AVR_ATmega48P__)  || defined(__AVR_ATmega48PB__)  \
-|| defined(__AVR_ATmega88__)    || defined(__AVR_ATmega88P__)  || defined(__AVR_ATmega88PB__)  \
-|| defined(__AVR_ATmega168__)   || defined(__AVR_ATmega168P__) || defined(__AVR_ATmega168PB__) \
+#elif defined(__AVR_ATmega48__) || defined(__AVR_ATmega48A__) || defined(__AVR_ATmega48P__)    \
+|| defined(__AVR_ATmega48PA__)  || defined(__AVR_ATmega48PB__) || defined(__AVR_ATmega88__)    \
+|| defined(__AVR_ATmega88A__)   || defined(__AVR_ATmega88P__)  || defined(__AVR_ATmega88PA__)  \
+|| defined(__AVR_ATmega88PB__)  || defined(__AVR_ATmega168__)  || defined(__AVR_ATmega168A__)  \
+|| defined(__AVR_ATmega168P__)  || defined(__AVR_ATmega168PA__)|| defined(__AVR_ATmega168PB__) \
 || defined(__AVR_ATmega328__)   || defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328PB__)
   #define EXTERNAL 0
   #define DEFAULT 1 // Default -> AVCC with external capacitor at AREF pin
   #define INTERNAL1V1 3
   #define INTERNAL 3
+  #define TEMPERATURE_SENSOR // On ADC8, measured with the 1.1 V reference
 
 // 9 series
 #elif defined(__AVR_ATmega169__) || defined(__AVR_ATmega169A__)  || defined(__AVR_ATmega169P__)   \
@@ -139,6 +142,13 @@ void yield(void);
 
 #endif
 
+// Writing a logic one to PINxn toggles PORTxn on all but the "classic" series
+#if !defined(__AVR_ATmega8535__) && !defined(__AVR_ATmega8__)  && !defined(__AVR_ATmega16__)  \
+&& !defined(__AVR_ATmega32__)    && !defined(__AVR_ATmega64__) && !defined(__AVR_ATmega128__) \
+&& !defined(__AVR_ATmega8515__)  && !defined(__AVR_ATmega162__)
+  #define PINX_TOGGLE
+#endif
+
 #define interrupts() sei()
 #define noInterrupts() cli()
 
@@ -175,16 +185,135 @@ int atexit(void (*func)()) __attribute__((weak));
 void pinMode(uint8_t pin, uint8_t mode);
 void digitalWrite(uint8_t pin, uint8_t state);
 int digitalRead(uint8_t pin);
+void digitalToggle(uint8_t pin);
 int analogRead(uint8_t pin);
+void analogReadStart(uint8_t pin);
+uint8_t analogReadReady(void);
+int analogReadResult(void);
+void analogReadResolution(uint8_t bits);
+void analogReadSpeed(uint8_t prescaler);
+int analogReadQuiet(uint8_t pin);
+uint16_t readVcc(void);
+#if defined(TEMPERATURE_SENSOR)
+int16_t readInternalTemperature(void);
+#endif
+void calibrateInternalSensors(uint16_t bandgapMillivolts, int8_t temperatureOffset);
+void setInternalSensorCacheTime(uint16_t ms);
 void analogReference(uint8_t mode);
 void analogWrite(uint8_t pin, int value);
 
+// High resolution PWM on the 16-bit timers
+#define PWM_FAST          0
+#define PWM_PHASE_CORRECT 1
+uint8_t analogWriteResolution(uint8_t bits);
+unsigned long pwmSetup(uint8_t pin, unsigned long frequency, uint8_t mode);
+
+// Synchronized PWM updates on several channels
+void pwmStage(uint8_t pin, int value);
+void pwmCommit(void);
+uint8_t pwmCommitDone(void);
+
+// Software PWM on any pin, using Timer1
+#define SOFTPWM_MAX_CHANNELS 20
+unsigned long softPwmBegin(unsigned long frequency);
+void softPwmEnd(void);
+void softPwmWrite(uint8_t pin, uint8_t value);
+
+// Wavetable synthesizer on Timer2
+#define SYNTH_VOICES 4
+#define SYNTH_WAVETABLE __attribute__((aligned(256))) PROGMEM
+extern const int8_t synth_sine[256];
+extern const int8_t synth_triangle[256];
+extern const int8_t synth_sawtooth[256];
+extern const int8_t synth_square[256];
+unsigned long synthBegin(uint8_t pin);
+void synthEnd(void);
+void synthVoice(uint8_t voice, const int8_t *wavetable, unsigned int frequency, uint8_t amplitude);
+void synthFrequency(uint8_t voice, unsigned int frequency);
+void synthAmplitude(uint8_t voice, uint8_t amplitude);
+
+// Oversampled 11 to 16-bit readings
+void analogOversampleStart(uint8_t pin, uint8_t bits);
+uint8_t analogOversampleReady(uint8_t pin);
+uint16_t analogOversampleResult(uint8_t pin);
+uint16_t analogReadOversampled(uint8_t pin, uint8_t bits);
+
+// Interrupt driven round-robin ADC scanner
+#define ANALOG_SCAN_MAX_CHANNELS 8
+typedef struct
+{
+  uint8_t index;  // Position of the channel in the scan list
+  uint16_t value;
+} analog_sample_t;
+void analogScanBegin(const uint8_t *pins, uint8_t count);
+void analogScanEnd(void);
+int analogScanRead(uint8_t index);
+void analogScanBuffer(analog_sample_t *buffer, uint8_t size);
+uint8_t analogScanAvailable(void);
+uint8_t analogScanNext(analog_sample_t *sample);
+
+// Timer triggered ADC sampling into a double buffer
+#define ADC_TRIGGER_TIMER1 0
+#define ADC_TRIGGER_TIMER0 1
+void analogStreamBuffer(uint16_t *buffer, uint16_t blockSize);
+void analogStreamCallbacks(void (*half)(uint16_t *block), void (*full)(uint16_t *block));
+unsigned long analogStreamBegin(uint8_t pin, unsigned long rate, uint8_t trigger);
+void analogStreamEnd(void);
+uint16_t *analogStreamBlock(void);
+uint16_t analogStreamOverruns(void);
+
+// Analog comparator
+#define ANALOG_COMPARATOR_AIN0    0xfe
+#define ANALOG_COMPARATOR_BANDGAP 0xfd
+#define ANALOG_COMPARATOR_AIN1    0xff
+void analogComparatorBegin(uint8_t positive, uint8_t negative);
+void analogComparatorEnd(void);
+uint8_t analogComparatorRead(void);
+void analogComparatorAttachInterrupt(void (*callback)(void), uint8_t mode);
+void analogComparatorDetachInterrupt(void);
+void analogComparatorInputCapture(uint8_t enable);
+
+// millis() and micros() run on Timer0, unless MILLIS_TIMER2,
+// MILLIS_TIMER2_ASYNC or MILLIS_NONE is set in the millis()/micros() menu
+#if defined(MILLIS_TIMER2_ASYNC) && !defined(MILLIS_TIMER2)
+  #define MILLIS_TIMER2
+#endif
 unsigned long millis(void);
 unsigned long micros(void);
+
+// Raw count of the millis() timer, for checking elapsed time without the
+// conversion micros() does. A tick is 64 clock cycles, or 1/32768 second
+// with the Timer2 crystal. Ticks wrap like micros(), so only compare them
+// by subtracting, and only over intervals shorter than the wrap around
+#if !defined(MILLIS_NONE)
+  #if defined(MILLIS_TIMER2_ASYNC)
+    #define TICKS_PER_SECOND 32768UL
+  #else
+    #define TICKS_PER_SECOND (F_CPU / 64UL)
+  #endif
+typedef unsigned long Ticks;
+Ticks ticksNow(void);
+#define ticksElapsed(start) ((Ticks)(ticksNow() - (Ticks)(start)))
+#endif
 void delay(unsigned long ms);
 void delayMicroseconds(unsigned int us) __attribute__ ((noinline));
 unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout);
 unsigned long pulseInLong(uint8_t pin, uint8_t state, unsigned long timeout);
+unsigned long pulseInCapture(uint8_t state, unsigned long timeout);
+void pulseCaptureStart(uint8_t state, void (*callback)(unsigned long ticks));
+void pulseCaptureStop(void);
+uint8_t pulseCaptureDone(void);
+unsigned long pulseCaptureTicks(void);
+unsigned long pulseCaptureMicros(void);
+
+// 64-bit cycle counter on Timer1
+#define CYCLES_CLOCK      1
+#define CYCLES_CLOCK_DIV8 8
+void cyclesBegin(uint8_t prescaler);
+void cyclesEnd(void);
+uint32_t cycleTicks(void);
+uint64_t cycles64(void);
+uint64_t micros64(void);
 
 void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t val);
 uint8_t shiftIn(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder);
@@ -365,6 +494,7 @@ extern const uint8_t PROGMEM digital_pin_to_timer_PGM[];
 #include "HardwareSerial.h"
 #include "USBAPI.h"
 #include "wiring_extras.h"
+#include "wiring_fast.h"
 
 
 #if defined(HAVE_HWSERIAL0) && defined(HAVE_CDCSERIAL)
@@ -378,6 +508,22 @@ uint16_t makeWord(byte h, byte l);
 
 unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout = 1000000L);
 unsigned long pulseInLong(uint8_t pin, uint8_t state, unsigned long timeout = 1000000L);
+unsigned long pulseInCapture(uint8_t state, unsigned long timeout = 1000000L);
+void pulseCaptureStart(uint8_t state, void (*callback)(unsigned long ticks) = NULL);
+
+#if !defined(MILLIS_NONE)
+// Converts a time to ticks, rounded up so a deadline never passes early.
+// Meant for constants, which are converted at compile time
+constexpr Ticks usToTicks(unsigned long us)
+{
+  return ((unsigned long long)us * TICKS_PER_SECOND + 999999ULL) / 1000000ULL;
+}
+
+constexpr Ticks msToTicks(unsigned long ms)
+{
+  return ((unsigned long long)ms * TICKS_PER_SECOND + 999ULL) / 1000ULL;
+}
+#endif
 
 void tone(uint8_t pin, unsigned int frequency, unsigned long duration = 0);
 void noTone(uint8_t pin);
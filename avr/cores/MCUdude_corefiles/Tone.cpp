@@ -38,6 +38,7 @@ Version Modified By Date     Comments
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
 #include "Arduino.h"
+#include "wiring_private.h"
 #include "pins_arduino.h"
 
 // Fix missing definitions
@@ -57,38 +58,79 @@ Version Modified By Date     Comments
   #define TIMER2_COMPA_vect TIMER2_COMP_vect
 #endif
 
+// The durations of all tones are counted by the Timer0 compare match B
+// interrupt, that fires once per Timer0 overflow (1.024 ms at 16 MHz)
+// without disturbing millis() or the PWM on the Timer0 pins. It only counts
+// down to the tone that ends first, so its cost doesn't depend on the number
+// of tones. On the ATmega8, which lacks it, each timer interrupt counts the
+// toggles of its own tone instead. When millis() runs on Timer2, Timer0 plays
+// tones, and the Timer2 compare match B interrupt counts the durations
+#if defined(MILLIS_TIMER2) && defined(TIMSK2) && defined(OCIE2B) && defined(TIMER2_COMPB_vect)
+  #define TONE_DURATION_TICKS
+  #define TONE_TICK_TIMSK TIMSK2
+  #define TONE_TICK_TIFR  TIFR2
+  #define TONE_TICK_IE    OCIE2B
+  #define TONE_TICK_IF    OCF2B
+  #define TONE_TICK_vect  TIMER2_COMPB_vect
+  #if defined(MILLIS_TIMER2_ASYNC)
+    // Timer2 overflows per millisecond with a 32.768 kHz crystal, times 1024
+    #define TONE_TICKS_PER_MS_X1024 (32768UL * 1024UL / 256000UL)
+  #else
+    #define TONE_TICKS_PER_MS_X1024 (F_CPU / 16000UL)
+  #endif
+#elif !defined(MILLIS_TIMER2) && defined(TIMSK0) && defined(OCIE0B) && defined(TIMER0_COMPB_vect)
+  #define TONE_DURATION_TICKS
+  #define TONE_TICK_TIMSK TIMSK0
+  #define TONE_TICK_TIFR  TIFR0
+  #define TONE_TICK_IE    OCIE0B
+  #define TONE_TICK_IF    OCF0B
+  #define TONE_TICK_vect  TIMER0_COMPB_vect
+  // Timer0 overflows per millisecond, times 1024
+  #define TONE_TICKS_PER_MS_X1024 (F_CPU / 16000UL)
+#endif
+
 // timerx_toggle_count:
 //  > 0 - duration specified
 //  = 0 - stopped
 //  < 0 - infinitely (until stop() method called, or new play() called)
 
 #if !defined(__AVR_ATmega8__)
+  #if !defined(TONE_DURATION_TICKS)
   volatile long timer0_toggle_count;
+  #endif
   volatile uint8_t *timer0_pin_port;
   volatile uint8_t timer0_pin_mask;
 #endif
 
+#if !defined(TONE_DURATION_TICKS)
 volatile long timer1_toggle_count;
+volatile long timer2_toggle_count;
+#endif
 volatile uint8_t *timer1_pin_port;
 volatile uint8_t timer1_pin_mask;
-volatile long timer2_toggle_count;
 volatile uint8_t *timer2_pin_port;
 volatile uint8_t timer2_pin_mask;
 
 #if defined(TIMSK3)
+  #if !defined(TONE_DURATION_TICKS)
   volatile long timer3_toggle_count;
+  #endif
   volatile uint8_t *timer3_pin_port;
   volatile uint8_t timer3_pin_mask;
 #endif
 
 #if defined(TIMSK4)
+  #if !defined(TONE_DURATION_TICKS)
   volatile long timer4_toggle_count;
+  #endif
   volatile uint8_t *timer4_pin_port;
   volatile uint8_t timer4_pin_mask;
 #endif
 
 #if defined(TIMSK5)
+  #if !defined(TONE_DURATION_TICKS)
   volatile long timer5_toggle_count;
+  #endif
   volatile uint8_t *timer5_pin_port;
   volatile uint8_t timer5_pin_mask;
 #endif
@@ -145,13 +187,55 @@ volatile uint8_t timer2_pin_mask;
   static uint8_t tone_pins[AVAILABLE_TONE_PINS] = { 255 };
 
 #else // Generic
-  #define AVAILABLE_TONE_PINS 1
-  #define USE_TIMER2
-  const uint8_t PROGMEM tone_pin_to_timer_PGM[] = { 2 /*, 1, 0 */ };
-  static uint8_t tone_pins[AVAILABLE_TONE_PINS] = { 255 /*, 255, 255 */ };
+  // Timer2 plays a tone on any pin. With the shared duration counting,
+  // Timer1, Timer3 and Timer4 play one more tone each on their own output
+  // compare pins, which they toggle in hardware. They don't use an interrupt,
+  // so libraries like Servo can still have the Timer1 compare interrupt.
+  // Timer0 is left to millis(), unless millis() runs on Timer2. Then Timer0
+  // takes the place of Timer2
+  #if defined(MILLIS_TIMER2)
+    #define USE_TIMER0
+    #define TONE_FIRST_TIMER 0
+  #else
+    #define USE_TIMER2
+    #define TONE_FIRST_TIMER 2
+  #endif
+  const uint8_t PROGMEM tone_pin_to_timer_PGM[] =
+  {
+    TONE_FIRST_TIMER
+  #if defined(TONE_DURATION_TICKS)
+    , 1
+    #if defined(TIMSK3) && defined(COM3A0) && defined(WGM32)
+    , 3
+    #endif
+    #if defined(TIMSK4) && defined(COM4A0) && defined(WGM42)
+    , 4
+    #endif
+  #endif
+  };
+  #define AVAILABLE_TONE_PINS (int)(sizeof(tone_pin_to_timer_PGM) / sizeof(tone_pin_to_timer_PGM[0]))
+  static uint8_t tone_pins[AVAILABLE_TONE_PINS] = { 255
+  #if defined(TONE_DURATION_TICKS)
+    , 255
+    #if defined(TIMSK3) && defined(COM3A0) && defined(WGM32)
+    , 255
+    #endif
+    #if defined(TIMSK4) && defined(COM4A0) && defined(WGM42)
+    , 255
+    #endif
+  #endif
+  };
 
 #endif
 
+#if defined(TONE_DURATION_TICKS)
+  // Ticks left of each timed tone at the last update, 0 if untimed
+  static unsigned long tone_ticks_left[AVAILABLE_TONE_PINS];
+  // Ticks until the next update, and what it was set to at the last one
+  static volatile unsigned long tone_ticks_wait;
+  static unsigned long tone_ticks_wait_start;
+#endif
+
 // Identifies the timer which has prescaler values 1/8/32/64/128/256/1024
 // Other timers are lacking 32 and 128 because clock select bits are used
 // for external clock input
@@ -162,6 +246,94 @@ volatile uint8_t timer2_pin_mask;
 #endif
 
 
+// Returns true if the timer has a compare interrupt to toggle any pin with
+static bool toneTimerInterrupt(int8_t _timer)
+{
+  switch (_timer)
+  {
+#if defined(USE_TIMER0)
+    case 0:
+#endif
+#if defined(USE_TIMER1)
+    case 1:
+#endif
+#if defined(USE_TIMER2)
+    case 2:
+#endif
+#if defined(USE_TIMER3)
+    case 3:
+#endif
+#if defined(USE_TIMER4)
+    case 4:
+#endif
+#if defined(USE_TIMER5)
+    case 5:
+#endif
+      return true;
+  }
+  return false;
+}
+
+
+// Returns the timer with an output compare unit on the pin, and the
+// COM bits that let it toggle the pin in hardware on every compare match.
+// Returns -1 if there's none
+static int8_t tonePinTimer(uint8_t _pin, uint8_t *com)
+{
+  switch (digitalPinToTimer(_pin))
+  {
+#if defined(TCCR0A) && defined(COM0A0) && defined(COM0B0)
+    case TIMER0A:
+      *com = _BV(COM0A0);
+      return 0;
+    case TIMER0B:
+      *com = _BV(COM0B0);
+      return 0;
+#endif
+
+#if defined(COM1A0) && defined(COM1B0)
+    case TIMER1A:
+      *com = _BV(COM1A0);
+      return 1;
+    case TIMER1B:
+      *com = _BV(COM1B0);
+      return 1;
+#endif
+
+#if defined(COM2A0)
+    case TIMER2:
+    case TIMER2A:
+      *com = _BV(COM2A0);
+      return 2;
+  #if defined(COM2B0) && defined(OCR2B)
+    case TIMER2B:
+      *com = _BV(COM2B0);
+      return 2;
+  #endif
+#endif
+
+#if defined(COM3A0) && defined(COM3B0)
+    case TIMER3A:
+      *com = _BV(COM3A0);
+      return 3;
+    case TIMER3B:
+      *com = _BV(COM3B0);
+      return 3;
+#endif
+
+#if defined(COM4A0) && defined(COM4B0)
+    case TIMER4A:
+      *com = _BV(COM4A0);
+      return 4;
+    case TIMER4B:
+      *com = _BV(COM4B0);
+      return 4;
+#endif
+  }
+  return -1;
+}
+
+
 static int8_t toneBegin(uint8_t _pin)
 {
   int8_t _timer = -1;
@@ -173,11 +345,15 @@ static int8_t toneBegin(uint8_t _pin)
     }
   }
 
-  // search for an unused timer.
+  // search for an unused timer. A timer without interrupt can only play a
+  // tone on its own output compare pins.
+  uint8_t com;
+  int8_t pinTimer = tonePinTimer(_pin, &com);
   for (int i = 0; i < AVAILABLE_TONE_PINS; i++) {
-    if (tone_pins[i] == 255) {
+    int8_t timer = pgm_read_byte(tone_pin_to_timer_PGM + i);
+    if (tone_pins[i] == 255 && (timer == pinTimer || toneTimerInterrupt(timer))) {
       tone_pins[i] = _pin;
-      _timer = pgm_read_byte(tone_pin_to_timer_PGM + i);
+      _timer = timer;
       break;
     }
   }
@@ -204,7 +380,12 @@ static int8_t toneBegin(uint8_t _pin)
 
       #if defined(TCCR1A) && defined(TCCR1B) && defined(WGM12)
       case 1:
+      {
         // 16 bit timer
+        uint8_t oldSREG = SREG;
+        cli();
+        timer1_busy |= TIMER1_BUSY_TONE;
+        SREG = oldSREG;
         TCCR1A = 0;
         TCCR1B = 0;
         bitWrite(TCCR1B, WGM12, 1);
@@ -212,15 +393,16 @@ static int8_t toneBegin(uint8_t _pin)
         timer1_pin_port = portOutputRegister(digitalPinToPort(_pin));
         timer1_pin_mask = digitalPinToBitMask(_pin);
         break;
+      }
       #endif
 
       #if defined(TCCR2A) && defined(TCCR2B)
       case 2:
         // 8 bit timer
-        TCCR2A = 0;
-        TCCR2B = 0;
-        bitWrite(TCCR2A, WGM21, 1);
-        bitWrite(TCCR2B, CS20, 1);
+        timer2Write(TCCR2A, TCR2AUB, 0);
+        timer2Write(TCCR2B, TCR2BUB, 0);
+        timer2Write(TCCR2A, TCR2AUB, TCCR2A | _BV(WGM21));
+        timer2Write(TCCR2B, TCR2BUB, TCCR2B | _BV(CS20));
         timer2_pin_port = portOutputRegister(digitalPinToPort(_pin));
         timer2_pin_mask = digitalPinToBitMask(_pin);
         break;
@@ -275,12 +457,87 @@ static int8_t toneBegin(uint8_t _pin)
 
 
 
+// Returns the COM bits that let the timer toggle the pin in hardware on
+// every compare match, or 0 if the pin isn't an output compare pin of it
+static uint8_t toneHardwareToggle(int8_t _timer, uint8_t _pin)
+{
+  uint8_t com = 0;
+  if (tonePinTimer(_pin, &com) != _timer)
+    return 0;
+  return com;
+}
+
+
+#if defined(TONE_DURATION_TICKS)
+// Brings the ticks left of the timed tones up to date, ends the ones that
+// are done, and waits for the one that ends next. Called with interrupts
+// disabled
+static void toneUpdateDurations(void)
+{
+  unsigned long elapsed = tone_ticks_wait_start - tone_ticks_wait;
+  unsigned long next = 0;
+
+  for (uint8_t i = 0; i < AVAILABLE_TONE_PINS; i++) {
+    unsigned long left = tone_ticks_left[i];
+    if (left == 0)
+      continue;
+    if (left <= elapsed) {
+      noTone(tone_pins[i]);
+      continue;
+    }
+    left -= elapsed;
+    tone_ticks_left[i] = left;
+    if (next == 0 || left < next)
+      next = left;
+  }
+
+  tone_ticks_wait = next;
+  tone_ticks_wait_start = next;
+  if (next == 0)
+    bitWrite(TONE_TICK_TIMSK, TONE_TICK_IE, 0);
+}
+
+// Starts counting the duration of the tone on the pin, or stops counting it
+// if the duration is 0
+static void toneDuration(uint8_t _pin, unsigned long duration)
+{
+  unsigned long ticks = 0;
+  if (duration > 0)
+  {
+    ticks = (duration < 0x100000UL) ? (duration * TONE_TICKS_PER_MS_X1024) >> 10
+                                    : (duration >> 10) * TONE_TICKS_PER_MS_X1024;
+    if (ticks == 0)
+      ticks = 1;
+  }
+
+  uint8_t oldSREG = SREG;
+  cli();
+  toneUpdateDurations();
+  for (uint8_t i = 0; i < AVAILABLE_TONE_PINS; i++) {
+    if (tone_pins[i] == _pin)
+      tone_ticks_left[i] = ticks;
+  }
+  if (ticks && (tone_ticks_wait == 0 || ticks < tone_ticks_wait))
+  {
+    if (tone_ticks_wait == 0)
+      TONE_TICK_TIFR = _BV(TONE_TICK_IF);
+    tone_ticks_wait = ticks;
+    tone_ticks_wait_start = ticks;
+    bitWrite(TONE_TICK_TIMSK, TONE_TICK_IE, 1);
+  }
+  SREG = oldSREG;
+}
+#endif
+
+
 // Frequency (in hertz) and duration (in milliseconds).
 
 void tone(uint8_t _pin, unsigned int frequency, unsigned long duration)
 {
   uint8_t prescalarbits = 0x01;
+#if !defined(TONE_DURATION_TICKS)
   long toggle_count = 0;
+#endif
   uint32_t ocr = 0;
   int8_t _timer;
 
@@ -341,7 +598,7 @@ void tone(uint8_t _pin, unsigned int frequency, unsigned long duration)
 #endif
 #if defined(TCCR2B)
       {
-        TCCR2B = (TCCR2B & 0xf8) | prescalarbits;
+        timer2Write(TCCR2B, TCR2BUB, (TCCR2B & 0xf8) | prescalarbits);
       }
 #else
       {
@@ -383,6 +640,7 @@ void tone(uint8_t _pin, unsigned int frequency, unsigned long duration)
     }
 
 
+#if !defined(TONE_DURATION_TICKS)
     // Calculate the toggle count
     if (duration > 0)
     {
@@ -392,80 +650,151 @@ void tone(uint8_t _pin, unsigned int frequency, unsigned long duration)
     {
       toggle_count = -1;
     }
+#endif
+
+    // A pin on an output compare unit of the timer is toggled in hardware,
+    // and only needs the interrupt when it has to count the toggles
+    uint8_t com = toneHardwareToggle(_timer, _pin);
+#if defined(TONE_DURATION_TICKS)
+    uint8_t useInterrupt = !com;
+#else
+    uint8_t useInterrupt = !com || duration > 0;
+#endif
 
     // Set the OCR for the given timer,
     // set the toggle count,
-    // then turn on the interrupts
+    // then turn on the interrupts.
+    // In CTC mode, compare match B happens once per period as well, when the
+    // counter passes OCRxB
     switch (_timer)
     {
 
 #if defined(OCR0A) && defined(TIMSK0) && defined(OCIE0A)
       case 0:
         OCR0A = ocr;
+#if defined(TCCR0A) && defined(OCR0B)
+        if (com)
+        {
+          OCR0B = 0;
+          TCCR0A |= com;
+          timer0_pin_mask = 0;
+        }
+#endif
+#if !defined(TONE_DURATION_TICKS)
         timer0_toggle_count = toggle_count;
-        bitWrite(TIMSK0, OCIE0A, 1);
+#endif
+        bitWrite(TIMSK0, OCIE0A, useInterrupt);
         break;
 #endif
 
       case 1:
-#if defined(OCR1A) && defined(TIMSK1) && defined(OCIE1A)
+#if defined(OCR1A) && defined(OCR1B) && defined(OCIE1A) && (defined(TIMSK1) || defined(TIMSK))
         OCR1A = ocr;
+        if (com)
+        {
+          OCR1B = 0;
+          TCCR1A |= com;
+          timer1_pin_mask = 0; // Nothing left for the interrupt to toggle
+        }
+#if !defined(TONE_DURATION_TICKS)
         timer1_toggle_count = toggle_count;
-        bitWrite(TIMSK1, OCIE1A, 1);
-#elif defined(OCR1A) && defined(TIMSK) && defined(OCIE1A)
+#endif
+#if defined(TIMSK1)
+        bitWrite(TIMSK1, OCIE1A, useInterrupt);
+#else
         // this combination is for at least the ATmega32
-        OCR1A = ocr;
-        timer1_toggle_count = toggle_count;
-        bitWrite(TIMSK, OCIE1A, 1);
+        bitWrite(TIMSK, OCIE1A, useInterrupt);
+#endif
 #endif
         break;
 
 #if defined(OCR2A) && defined(TIMSK2) && defined(OCIE2A)
       case 2:
-        OCR2A = ocr;
+        timer2Write(OCR2A, OCR2AUB, ocr);
+        if (com)
+        {
+#if defined(COM2B0) && defined(OCR2B)
+          timer2Write(OCR2B, OCR2BUB, 0);
+#endif
+          timer2Write(TCCR2A, TCR2AUB, TCCR2A | com);
+          timer2_pin_mask = 0;
+        }
+#if !defined(TONE_DURATION_TICKS)
         timer2_toggle_count = toggle_count;
-        bitWrite(TIMSK2, OCIE2A, 1);
+#endif
+        bitWrite(TIMSK2, OCIE2A, useInterrupt);
         break;
 #endif
 
 #if defined(OCR3A) && defined(TIMSK3) && defined(OCIE3A)
       case 3:
         OCR3A = ocr;
+        if (com)
+        {
+          OCR3B = 0;
+          TCCR3A |= com;
+          timer3_pin_mask = 0;
+        }
+#if !defined(TONE_DURATION_TICKS)
         timer3_toggle_count = toggle_count;
-        bitWrite(TIMSK3, OCIE3A, 1);
+#endif
+        bitWrite(TIMSK3, OCIE3A, useInterrupt);
         break;
 #endif
 
 #if defined(OCR4A) && defined(TIMSK4) && defined(OCIE4A)
       case 4:
         OCR4A = ocr;
+        if (com)
+        {
+          #if defined(__AVR_ATmega328PB__) // Fix 324PB/328PB silicon bug
+            PORTD |= _BV(PD2);
+          #endif
+          OCR4B = 0;
+          TCCR4A |= com;
+          timer4_pin_mask = 0;
+        }
+#if !defined(TONE_DURATION_TICKS)
         timer4_toggle_count = toggle_count;
-        bitWrite(TIMSK4, OCIE4A, 1);
+#endif
+        bitWrite(TIMSK4, OCIE4A, useInterrupt);
         break;
 #endif
 
 #if defined(OCR5A) && defined(TIMSK5) && defined(OCIE5A)
       case 5:
         OCR5A = ocr;
+#if !defined(TONE_DURATION_TICKS)
         timer5_toggle_count = toggle_count;
+#endif
         bitWrite(TIMSK5, OCIE5A, 1);
         break;
 #endif
 
     }
+
+#if defined(TONE_DURATION_TICKS)
+    toneDuration(_pin, duration);
+#endif
   }
 }
 
 
-// XXX: this function only works properly for timer 2 (the only one we use
-// currently).  for the others, it should end the tone, but won't restore
-// proper PWM functionality for the timer.
+// Ends the tone, and puts timer 0 to 4 back in the PWM mode they were set
+// to by init(). Timer 0 only plays tones when millis() runs on Timer2, and
+// timer 5 isn't used on this core.
 void disableTimer(uint8_t _timer)
 {
   switch (_timer)
   {
     case 0:
-      #if defined(TIMSK0)
+      #if defined(TIMSK0) && defined(OCIE0A) && defined(TCCR0A)
+        bitWrite(TIMSK0, OCIE0A, 0);
+        TCCR0A = _BV(WGM01) | _BV(WGM00);
+        TCCR0B = _BV(CS01) | _BV(CS00);
+        OCR0A = 0;
+        OCR0B = 0;
+      #elif defined(TIMSK0)
         TIMSK0 = 0;
       #elif defined(TIMSK)
         TIMSK = 0; // atmega32
@@ -474,8 +803,24 @@ void disableTimer(uint8_t _timer)
 
 #if defined(TIMSK1) && defined(OCIE1A)
     case 1:
+    {
+      uint8_t oldSREG = SREG;
+      cli();
+      timer1_busy &= ~TIMER1_BUSY_TONE;
+      SREG = oldSREG;
       bitWrite(TIMSK1, OCIE1A, 0);
+      #if defined(TCCR1A) && defined(WGM10)
+        TCCR1A = (1 << WGM10);
+        #if F_CPU >= 8000000L
+          TCCR1B = (1 << CS11) | (1 << CS10);
+        #else
+          TCCR1B = (1 << CS11);
+        #endif
+      #endif
+      OCR1A = 0;
+      OCR1B = 0;
       break;
+    }
 #endif
 
     case 2:
@@ -483,25 +828,37 @@ void disableTimer(uint8_t _timer)
         bitWrite(TIMSK2, OCIE2A, 0); // disable interrupt
       #endif
       #if defined(TCCR2A) && defined(WGM20)
-        TCCR2A = (1 << WGM20);
+        timer2Write(TCCR2A, TCR2AUB, (1 << WGM20));
       #endif
       #if defined(TCCR2B) && defined(CS22)
-        TCCR2B = (TCCR2B & 0xf8) | (1 << CS22);
+        timer2Write(TCCR2B, TCR2BUB, (TCCR2B & 0xf8) | (1 << CS22));
       #endif
       #if defined(OCR2A)
-        OCR2A = 0;
+        timer2Write(OCR2A, OCR2AUB, 0);
       #endif
       break;
 
 #if defined(TIMSK3) && defined(OCIE3A)
     case 3:
       bitWrite(TIMSK3, OCIE3A, 0);
+      #if defined(WGM32) && defined(WGM30)
+        TCCR3A = (1 << WGM30);
+        TCCR3B = (1 << CS31) | (1 << CS30);
+        OCR3A = 0;
+        OCR3B = 0;
+      #endif
       break;
 #endif
 
 #if defined(TIMSK4) && defined(OCIE4A)
     case 4:
       bitWrite(TIMSK4, OCIE4A, 0);
+      #if defined(WGM42) && defined(WGM40)
+        TCCR4A = (1 << WGM40);
+        TCCR4B = (1 << CS41) | (1 << CS40);
+        OCR4A = 0;
+        OCR4B = 0;
+      #endif
       break;
 #endif
 
@@ -522,6 +879,13 @@ void noTone(uint8_t _pin)
     if (tone_pins[i] == _pin) {
       _timer = pgm_read_byte(tone_pin_to_timer_PGM + i);
       tone_pins[i] = 255;
+#if defined(TONE_DURATION_TICKS)
+      // The duration interrupt turns itself off once nothing is left to count
+      uint8_t oldSREG = SREG;
+      cli();
+      tone_ticks_left[i] = 0;
+      SREG = oldSREG;
+#endif
       break;
     }
   }
@@ -534,6 +898,9 @@ void noTone(uint8_t _pin)
 #ifdef USE_TIMER0
 ISR(TIMER0_COMPA_vect)
 {
+#if defined(TONE_DURATION_TICKS)
+  *timer0_pin_port ^= timer0_pin_mask;
+#else
   if (timer0_toggle_count != 0)
   {
     // toggle the pin
@@ -547,6 +914,7 @@ ISR(TIMER0_COMPA_vect)
     disableTimer(0);
     *timer0_pin_port &= ~(timer0_pin_mask);  // keep pin low after stop
   }
+#endif
 }
 #endif
 
@@ -554,6 +922,9 @@ ISR(TIMER0_COMPA_vect)
 #ifdef USE_TIMER1
 ISR(TIMER1_COMPA_vect)
 {
+#if defined(TONE_DURATION_TICKS)
+  *timer1_pin_port ^= timer1_pin_mask;
+#else
   if (timer1_toggle_count != 0)
   {
     // toggle the pin
@@ -567,6 +938,7 @@ ISR(TIMER1_COMPA_vect)
     disableTimer(1);
     *timer1_pin_port &= ~(timer1_pin_mask);  // keep pin low after stop
   }
+#endif
 }
 #endif
 
@@ -578,7 +950,9 @@ ISR(TIMER2_COMP_vect)
 ISR(TIMER2_COMPA_vect)
 #endif
 {
-
+#if defined(TONE_DURATION_TICKS)
+  *timer2_pin_port ^= timer2_pin_mask;
+#else
   if (timer2_toggle_count != 0)
   {
     // toggle the pin
@@ -596,6 +970,16 @@ ISR(TIMER2_COMPA_vect)
 //    disableTimer(2);
 //    *timer2_pin_port &= ~(timer2_pin_mask);  // keep pin low after stop
   }
+#endif
+}
+#endif
+
+
+#ifdef TONE_DURATION_TICKS
+ISR(TONE_TICK_vect)
+{
+  if (--tone_ticks_wait == 0)
+    toneUpdateDurations();
 }
 #endif
 
@@ -603,6 +987,9 @@ ISR(TIMER2_COMPA_vect)
 #ifdef USE_TIMER3
 ISR(TIMER3_COMPA_vect)
 {
+#if defined(TONE_DURATION_TICKS)
+  *timer3_pin_port ^= timer3_pin_mask;
+#else
   if (timer3_toggle_count != 0)
   {
     // toggle the pin
@@ -616,6 +1003,7 @@ ISR(TIMER3_COMPA_vect)
     disableTimer(3);
     *timer3_pin_port &= ~(timer3_pin_mask);  // keep pin low after stop
   }
+#endif
 }
 #endif
 
@@ -623,6 +1011,9 @@ ISR(TIMER3_COMPA_vect)
 #ifdef USE_TIMER4
 ISR(TIMER4_COMPA_vect)
 {
+#if defined(TONE_DURATION_TICKS)
+  *timer4_pin_port ^= timer4_pin_mask;
+#else
   if (timer4_toggle_count != 0)
   {
     // toggle the pin
@@ -636,6 +1027,7 @@ ISR(TIMER4_COMPA_vect)
     disableTimer(4);
     *timer4_pin_port &= ~(timer4_pin_mask);  // keep pin low after stop
   }
+#endif
 }
 #endif
 
@@ -643,6 +1035,9 @@ ISR(TIMER4_COMPA_vect)
 #ifdef USE_TIMER5
 ISR(TIMER5_COMPA_vect)
 {
+#if defined(TONE_DURATION_TICKS)
+  *timer5_pin_port ^= timer5_pin_mask;
+#else
   if (timer5_toggle_count != 0)
   {
     // toggle the pin
@@ -656,5 +1051,6 @@ ISR(TIMER5_COMPA_vect)
     disableTimer(5);
     *timer5_pin_port &= ~(timer5_pin_mask);  // keep pin low after stop
   }
+#endif
 }
 #endif
@@ -22,6 +22,50 @@
 
 #include "wiring_private.h"
 
+// Registers of the timer millis() and micros() run on. With a 32.768 kHz
+// crystal, Timer2 doesn't overflow a whole number of microseconds, so its
+// count is always converted the tickless way
+#if defined(MILLIS_TIMER2)
+  #if !defined(TCCR2A) || !defined(TIMSK2) || !defined(TIFR2)
+    #error millis() can not run on timer 2 on this microcontroller
+  #endif
+  // The crystal goes on the TOSC pins, which are the XTAL pins, so it can
+  // only be used with the internal oscillator. init() would otherwise wait
+  // forever for Timer2 to start
+  #if defined(MILLIS_TIMER2_ASYNC) && !defined(INTERNAL_OSCILLATOR)
+    #error millis() on a 32.768 kHz crystal needs an internal clock in the Clock menu, or -DINTERNAL_OSCILLATOR
+  #endif
+  #if defined(MILLIS_TIMER2_ASYNC) && !defined(MILLIS_TICKLESS)
+    #define MILLIS_TICKLESS
+  #endif
+  #define MILLIS_TCNT TCNT2
+  #define MILLIS_TIFR TIFR2
+  #define MILLIS_TOV TOV2
+  #define MILLIS_OVF_vect TIMER2_OVF_vect
+#elif !defined(MILLIS_NONE)
+  #if defined(TCNT0)
+    #define MILLIS_TCNT TCNT0
+  #elif defined(TCNT0L)
+    #define MILLIS_TCNT TCNT0L
+  #else
+    #error TIMER 0 not defined
+  #endif
+  #if defined(TIFR0)
+    #define MILLIS_TIFR TIFR0
+  #else
+    #define MILLIS_TIFR TIFR
+  #endif
+  #define MILLIS_TOV TOV0
+  #if defined(__AVR_ATtiny24__) || defined(__AVR_ATtiny44__) || defined(__AVR_ATtiny84__)
+    #define MILLIS_OVF_vect TIM0_OVF_vect
+  #else
+    #define MILLIS_OVF_vect TIMER0_OVF_vect
+  #endif
+#endif
+
+// Core functions that have taken over Timer1, see wiring_private.h
+volatile uint8_t timer1_busy = 0;
+
 // the prescaler is set so that timer0 ticks every 64 clock cycles, and the
 // the overflow handler is called every 256 ticks.
 // 24MHz: An overflow happens every 682.67 microseconds ---> 0.04167, so this results in 682
@@ -57,6 +101,21 @@
 // Shift right by 3 to fit in a byte (results in 125)
 #define FRACT_MAX (1000U >> 3)
 
+#if defined(MILLIS_NONE)
+
+// Without a timer, there's no time to tell. delay() still works, since it
+// counts microsecond delays instead
+unsigned long millis()
+{
+  return 0;
+}
+
+unsigned long micros() {
+  return 0;
+}
+
+#elif !defined(MILLIS_TICKLESS)
+
 volatile unsigned long timer0_millis = 0;
 volatile unsigned char timer0_fract = 0;
 
@@ -145,17 +204,12 @@ volatile unsigned char timer0_fract = 0;
 #endif // fallback
 #endif // EXACT_REM > 0
 
-#ifndef CORRECT_EXACT_MICROS
-// variable is only needed in micros() calculation without exactness correction
+// used by micros() without exactness correction, and by ticksNow()
 volatile unsigned long timer0_overflow_count = 0;
-#endif
 
 // timer0 interrupt routine ,- is called every time timer0 overflows
-#if defined(__AVR_ATtiny24__) || defined(__AVR_ATtiny44__) || defined(__AVR_ATtiny84__)
-ISR(TIM0_OVF_vect)
-#else
-ISR(TIMER0_OVF_vect)
-#endif
+// (or timer 2, if millis() runs on it. The names are kept for compatibility)
+ISR(MILLIS_OVF_vect)
 {
 #ifdef CORRECT_EXACT_MILLIS
   // this is a variable that retains its value between calls
@@ -207,9 +261,25 @@ ISR(TIMER0_OVF_vect)
 
   timer0_fract = f;
   timer0_millis = m;
-#ifndef CORRECT_EXACT_MICROS
   timer0_overflow_count++;
-#endif
+}
+
+// The count of timer0 extended by its overflows, read the same way as in
+// micros() below
+Ticks ticksNow(void)
+{
+  unsigned long m;
+  uint8_t t;
+  uint8_t oldSREG = SREG;
+
+  cli();
+  m = timer0_overflow_count;
+  t = MILLIS_TCNT;
+  if ((MILLIS_TIFR & _BV(MILLIS_TOV)) && (t < 255))
+    m++;
+  SREG = oldSREG;
+
+  return (m << 8) + t;
 }
 
 unsigned long millis()
@@ -248,29 +318,14 @@ unsigned long micros() {
 #endif
 
   // TCNT0 : The Timer Counter Register
-#if defined(TCNT0)
-  t = TCNT0;
-#elif defined(TCNT0L)
-  t = TCNT0L;
-#else
-  #error TIMER 0 not defined
-#endif
+  t = MILLIS_TCNT;
 
   // Timer0 Interrupt Flag Register
-#ifdef TIFR0
-  if ((TIFR0 & _BV(TOV0)) && (t < 255))
-#ifndef CORRECT_EXACT_MICROS
-    m++;
-#else
-    q = 1;
-#endif
-#else
-  if ((TIFR & _BV(TOV0)) && (t < 255))
+  if ((MILLIS_TIFR & _BV(MILLIS_TOV)) && (t < 255))
 #ifndef CORRECT_EXACT_MICROS
     m++;
 #else
     q = 1;
-#endif
 #endif
   // Restore SREG
   SREG = oldSREG;
@@ -392,6 +447,194 @@ unsigned long micros() {
 #endif // 0
 }
 
+#else // MILLIS_TICKLESS
+
+// Tickless timekeeping. The Timer0 (or Timer2) overflow interrupt only
+// extends the count of the timer in software, and millis() and micros()
+// convert the count when they're called, instead of the interrupt doing the
+// fraction and correction arithmetic above on every overflow. The timer
+// can't count past 256 ticks on its own, so the overflow interrupt still has
+// to see every overflow. The compare interrupts stay free, and are only
+// enabled while something waits for a timeout, like the duration of a tone.
+//
+// The count is kept as whole periods, each an exact number of milliseconds
+// long, and the overflows into the current period. Within a period, the
+// overflows are grouped into the smallest number that takes an exact number
+// of microseconds.
+#if defined(MILLIS_TIMER2_ASYNC)
+// Timer2 counts the 32.768 kHz crystal without prescaler
+#define TICKLESS_PERIOD 128
+#define TICKLESS_PERIOD_MS 1000
+#define TICKLESS_GROUP 2
+#define TICKLESS_GROUP_US 15625UL
+#elif F_CPU == 20000000L
+#define TICKLESS_PERIOD 625       // Timer overflows per period
+#define TICKLESS_PERIOD_MS 512    // Milliseconds per period
+#define TICKLESS_GROUP 5          // Timer overflows per group
+#define TICKLESS_GROUP_US 4096UL  // Microseconds per group
+#elif F_CPU == 18432000L
+#define TICKLESS_PERIOD 9
+#define TICKLESS_PERIOD_MS 8
+#define TICKLESS_GROUP 9
+#define TICKLESS_GROUP_US 8000UL
+#elif F_CPU == 16000000L
+#define TICKLESS_PERIOD 125
+#define TICKLESS_PERIOD_MS 128
+#define TICKLESS_GROUP 1
+#define TICKLESS_GROUP_US 1024UL
+#elif F_CPU == 14745600L
+#define TICKLESS_PERIOD 9
+#define TICKLESS_PERIOD_MS 10
+#define TICKLESS_GROUP 9
+#define TICKLESS_GROUP_US 10000UL
+#elif F_CPU == 12000000L
+#define TICKLESS_PERIOD 375
+#define TICKLESS_PERIOD_MS 512
+#define TICKLESS_GROUP 3
+#define TICKLESS_GROUP_US 4096UL
+#elif F_CPU == 11059200L
+#define TICKLESS_PERIOD 27
+#define TICKLESS_PERIOD_MS 40
+#define TICKLESS_GROUP 27
+#define TICKLESS_GROUP_US 40000UL
+#elif F_CPU == 9216000L
+#define TICKLESS_PERIOD 9
+#define TICKLESS_PERIOD_MS 16
+#define TICKLESS_GROUP 9
+#define TICKLESS_GROUP_US 16000UL
+#elif F_CPU == 8000000L
+#define TICKLESS_PERIOD 125
+#define TICKLESS_PERIOD_MS 256
+#define TICKLESS_GROUP 1
+#define TICKLESS_GROUP_US 2048UL
+#elif F_CPU == 7372800L
+#define TICKLESS_PERIOD 9
+#define TICKLESS_PERIOD_MS 20
+#define TICKLESS_GROUP 9
+#define TICKLESS_GROUP_US 20000UL
+#elif F_CPU == 6000000L
+#define TICKLESS_PERIOD 375
+#define TICKLESS_PERIOD_MS 1024
+#define TICKLESS_GROUP 3
+#define TICKLESS_GROUP_US 8192UL
+#elif F_CPU == 4000000L
+#define TICKLESS_PERIOD 125
+#define TICKLESS_PERIOD_MS 512
+#define TICKLESS_GROUP 1
+#define TICKLESS_GROUP_US 4096UL
+#elif F_CPU == 3686400L
+#define TICKLESS_PERIOD 9
+#define TICKLESS_PERIOD_MS 40
+#define TICKLESS_GROUP 9
+#define TICKLESS_GROUP_US 40000UL
+#elif F_CPU == 2000000L
+#define TICKLESS_PERIOD 125
+#define TICKLESS_PERIOD_MS 1024
+#define TICKLESS_GROUP 1
+#define TICKLESS_GROUP_US 8192UL
+#elif F_CPU == 1843200L
+#define TICKLESS_PERIOD 9
+#define TICKLESS_PERIOD_MS 80
+#define TICKLESS_GROUP 9
+#define TICKLESS_GROUP_US 80000UL
+#elif F_CPU == 1000000L
+#define TICKLESS_PERIOD 125
+#define TICKLESS_PERIOD_MS 2048
+#define TICKLESS_GROUP 1
+#define TICKLESS_GROUP_US 16384UL
+#else
+#error MILLIS_TICKLESS is not supported at this clock frequency
+#endif
+
+static volatile unsigned long timer0_periods = 0;
+static volatile uint16_t timer0_period_overflows = 0;
+
+ISR(MILLIS_OVF_vect)
+{
+  uint16_t r = timer0_period_overflows + 1;
+  if (r == TICKLESS_PERIOD) {
+    r = 0;
+    timer0_periods++;
+  }
+  timer0_period_overflows = r;
+}
+
+// Reads the whole periods, the overflows into the current period and the
+// timer count. An overflow that's flagged but not handled yet is counted, the
+// same way micros() does it without MILLIS_TICKLESS
+static unsigned long timer0Read(uint16_t *overflows, uint8_t *count)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+
+  unsigned long q = timer0_periods;
+  uint16_t r = timer0_period_overflows;
+  uint8_t t = MILLIS_TCNT;
+
+  if ((MILLIS_TIFR & _BV(MILLIS_TOV)) && (t < 255)) {
+    if (++r == TICKLESS_PERIOD) {
+      r = 0;
+      q++;
+    }
+  }
+  SREG = oldSREG;
+
+  *overflows = r;
+  *count = t;
+  return q;
+}
+
+unsigned long millis()
+{
+  uint16_t r;
+  uint8_t t;
+  unsigned long q = timer0Read(&r, &t);
+
+  return q * TICKLESS_PERIOD_MS +
+         ((((unsigned long)r << 8) + t) * TICKLESS_PERIOD_MS) / (TICKLESS_PERIOD * 256UL);
+}
+
+unsigned long micros() {
+  uint16_t r;
+  uint8_t t;
+  unsigned long q = timer0Read(&r, &t);
+
+  // Whole groups into the period, and the overflows into the current group
+  uint16_t g = r / TICKLESS_GROUP;
+  r -= g * TICKLESS_GROUP;
+
+  unsigned long m = q * (TICKLESS_PERIOD_MS * 1000UL) + g * TICKLESS_GROUP_US;
+#if TICKLESS_GROUP == 1 && TICKLESS_GROUP_US % 256 == 0
+  // All power-of-two Megahertz frequencies enter here
+  return m + t * (TICKLESS_GROUP_US >> 8);
+#else
+  return m + ((((unsigned long)r << 8) + t) * TICKLESS_GROUP_US) / (TICKLESS_GROUP * 256UL);
+#endif
+}
+
+// The periods are an exact number of overflows, so the count of the timer
+// is the same whether it's kept as overflows or as periods
+Ticks ticksNow(void)
+{
+  uint16_t r;
+  uint8_t t;
+  unsigned long q = timer0Read(&r, &t);
+
+  return ((q * TICKLESS_PERIOD + r) << 8) + t;
+}
+
+#endif // MILLIS_TICKLESS
+
+#if defined(MILLIS_NONE)
+void delay(unsigned long ms)
+{
+  while (ms > 0UL) {
+    yield();
+    delayMicroseconds(1000);
+    ms--;
+  }
+}
+#else
 void delay(unsigned long ms)
 {
   unsigned long start = micros();
@@ -404,6 +647,7 @@ void delay(unsigned long ms)
     }
   }
 }
+#endif
 
 /* Delay for the given number of microseconds.
  * Assumes a 1, 1.8432, 2, 3.6864, 4, 7.3728, 8, 9.216, 10, 11.0592, 12, 14.7456, 16,
@@ -977,8 +1221,10 @@ void init()
   #error Timer 0 prescale factor 64 not set correctly
 #endif
 
-// Enable timer 0 overflow interrupt
-#if defined(TIMSK) && defined(TOIE0)
+// Enable timer 0 overflow interrupt, unless millis() runs on timer 2 or not at all
+#if defined(MILLIS_TIMER2) || defined(MILLIS_NONE)
+  // Timer 0 is left running for pwm
+#elif defined(TIMSK) && defined(TOIE0)
   TIMSK |= _BV(TOIE0);
 #elif defined(TIMSK0) && defined(TOIE0)
   TIMSK0 |= _BV(TOIE0);
@@ -1024,6 +1270,24 @@ void init()
   // Timer 2 not finished (may not be present on this CPU)
 #endif
 
+#if defined(MILLIS_TIMER2_ASYNC)
+  // Clock timer 2 from the 32.768 kHz crystal on the TOSC pins, in fast pwm
+  // mode without prescaler. The registers are written through the
+  // asynchronous clock domain, so wait until they're updated
+  ASSR |= _BV(AS2);
+  TCNT2 = 0;
+  TCCR2A = _BV(WGM21) | _BV(WGM20);
+  TCCR2B = _BV(CS20);
+  while (ASSR & (_BV(TCN2UB) | _BV(TCR2AUB) | _BV(TCR2BUB)));
+  TIFR2 = _BV(OCF2B) | _BV(OCF2A) | _BV(TOV2);
+  TIMSK2 |= _BV(TOIE2);
+#elif defined(MILLIS_TIMER2)
+  // Fast pwm, so timer 2 overflows every 256 ticks at a prescale factor of 64,
+  // just like timer 0
+  TCCR2A |= _BV(WGM21);
+  TIMSK2 |= _BV(TOIE2);
+#endif
+
 #if defined(TCCR3B) && defined(CS31) && defined(WGM30)
   TCCR3B |= _BV(CS31) | _BV(CS30); // Set timer 3 prescale factor to 64
   TCCR3A |= _BV(WGM30);            // Put timer 3 in 8-bit phase correct pwm mode
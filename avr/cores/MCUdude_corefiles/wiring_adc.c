@@ -0,0 +1,24 @@
+/* wiring_adc.c
+|| Shared ADC conversion complete interrupt
+||
+|| The interrupt driven analog functions install their handler in
+|| adc_handler. The interrupt lives in its own file, so it's only linked
+|| when one of them is used.
+*/
+
+#include "wiring_private.h"
+
+#if defined(ADC_vect)
+
+static void adcNoHandler(void)
+{
+}
+
+volatile voidFuncPtr adc_handler = adcNoHandler;
+
+ISR(ADC_vect)
+{
+  adc_handler();
+}
+
+#endif
@@ -41,7 +41,36 @@ void analogReference(uint8_t mode)
   analog_reference = mode;
 }
 
-int analogRead(uint8_t pin)
+// ADLAR bit to include in ADMUX, set for 8-bit results
+uint8_t analog_adlar = 0;
+
+void analogReadResolution(uint8_t bits)
+{
+  // With a left adjusted result, the upper 8 bits can be read from ADCH
+  // with a single load. Anything above 8 bits gives the full 10 bits
+#if defined(ADLAR)
+  analog_adlar = (bits <= 8) ? _BV(ADLAR) : 0;
+#else
+  (void)bits;
+#endif
+}
+
+void analogReadSpeed(uint8_t prescaler)
+{
+#if defined(ADCSRA) && defined(ADPS0)
+  // Round down to a power of two from 2 to 128
+  uint8_t adps = 1;
+  while(adps < 7 && (2 << adps) <= prescaler)
+    adps++;
+
+  // Keep ADIF out of the write, so a pending conversion complete flag isn't cleared
+  ADCSRA = (ADCSRA & ~(_BV(ADIF) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0))) | adps;
+#else
+  (void)prescaler;
+#endif
+}
+
+void analogReadStart(uint8_t pin)
 {
 
 // Macro located in the pins_arduino.h file
@@ -63,9 +92,9 @@ int analogRead(uint8_t pin)
   
   // set the analog reference (high two bits of ADMUX) and select the
   // channel (low 4 bits).  this also sets ADLAR (left-adjust result)
-  // to 0 (the default).
+  // according to analogReadResolution().
 #if defined(ADMUX)
-  ADMUX = (analog_reference << 6) | (pin & 0x07);
+  ADMUX = analogChannelToMux(pin);
 #endif
 
   // without a delay, we seem to read from the wrong channel
@@ -74,18 +103,356 @@ int analogRead(uint8_t pin)
 #if defined(ADCSRA) && defined(ADC)
   // start the conversion
   ADCSRA |= _BV(ADSC);
+#endif
+}
 
+uint8_t analogReadReady(void)
+{
+#if defined(ADCSRA) && defined(ADC)
   // ADSC is cleared when the conversion finishes
+  return !(ADCSRA & _BV(ADSC));
+#else
+  return 1;
+#endif
+}
+
+int analogReadResult(void)
+{
+#if defined(ADCSRA) && defined(ADC)
+  // wait for the conversion to finish, if it hasn't already
   while (ADCSRA & _BV(ADSC)) {};
 
-  // ADC macro takes care of reading ADC register.
- 	// avr-gcc implements the proper reading order: ADCL is read first.
- 	return ADC;
+  // In 8-bit mode only ADCH is read. Otherwise the ADC macro takes care of
+  // reading ADC register. avr-gcc implements the proper reading order:
+  // ADCL is read first.
+  return analogConversionResult();
 #else
   return 0;
 #endif
 }
 
+int analogRead(uint8_t pin)
+{
+  analogReadStart(pin);
+  return analogReadResult();
+}
+
+
+/* Internal bandgap reference and temperature sensor */
+
+#if defined(__AVR_ATmega8__)
+  // The ATmega8 has a 1.30 V bandgap and no temperature sensor
+  #define BANDGAP_CHANNEL 0x0E
+  #ifndef BANDGAP_MILLIVOLTS
+    #define BANDGAP_MILLIVOLTS 1300
+  #endif
+#elif defined(TEMPERATURE_SENSOR) // Set in Arduino.h for the 8 series
+  // 1.1 V bandgap, and a temperature sensor on ADC8 that must be measured
+  // with the internal 1.1 V reference. Typically 314 mV at 25 °C, with a
+  // slope of 1.06 mV/°C
+  #define BANDGAP_CHANNEL 0x0E
+  #ifndef BANDGAP_MILLIVOLTS
+    #define BANDGAP_MILLIVOLTS 1100
+  #endif
+  #define TEMPERATURE_CHANNEL 0x08
+  #define TEMPERATURE_MILLIVOLTS_25C 314
+  #define TEMPERATURE_SLOPE_X100 106
+#endif
+
+#if defined(BANDGAP_CHANNEL) && defined(ADMUX) && defined(ADCSRA)
+
+static uint16_t bandgap_millivolts = BANDGAP_MILLIVOLTS;
+static int8_t temperature_offset = 0;
+static uint16_t internal_cache_time = 1000;
+
+static uint16_t vcc_cached;
+static unsigned long vcc_timestamp;
+static uint8_t vcc_valid;
+#if defined(TEMPERATURE_CHANNEL)
+static int16_t temperature_cached;
+static unsigned long temperature_timestamp;
+static uint8_t temperature_valid;
+#endif
+
+// Converts an internal channel. The first conversion after switching the
+// channel is thrown away, and switching the reference needs a few
+// milliseconds for the AREF capacitor to settle. ADMUX is restored
+// afterwards, and given the same settling time if the reference is switched
+// back, so the next analogRead() isn't affected
+static uint16_t analogReadInternal(uint8_t reference, uint8_t channel)
+{
+  while(ADCSRA & _BV(ADSC));
+
+  uint8_t oldMux = ADMUX;
+  uint8_t mux = (reference << 6) | channel;
+  uint8_t referenceChanged = (oldMux ^ mux) & (_BV(REFS1) | _BV(REFS0));
+
+  ADMUX = mux;
+  if(referenceChanged)
+    delay(5);
+  else
+    delayMicroseconds(100);
+
+  for(uint8_t i = 0; i < 2; i++)
+  {
+    ADCSRA |= _BV(ADSC);
+    while(ADCSRA & _BV(ADSC));
+  }
+  uint16_t result = ADC;
+
+  ADMUX = oldMux;
+  if(referenceChanged)
+    delay(5);
+  return result;
+}
+
+// Returns true if a measurement taken at the timestamp is still within the
+// cache time. Without millis() every call measures again
+static uint8_t internalCacheValid(unsigned long timestamp)
+{
+#if defined(MILLIS_NONE)
+  (void)timestamp;
+  return 0;
+#else
+  return millis() - timestamp < internal_cache_time;
+#endif
+}
+
+void calibrateInternalSensors(uint16_t bandgapMillivolts, int8_t temperatureOffset)
+{
+  bandgap_millivolts = bandgapMillivolts;
+  temperature_offset = temperatureOffset;
+  vcc_valid = 0;
+#if defined(TEMPERATURE_CHANNEL)
+  temperature_valid = 0;
+#endif
+}
+
+void setInternalSensorCacheTime(uint16_t ms)
+{
+  internal_cache_time = ms;
+}
+
+/* Returns the supply voltage in millivolts, measured by converting the
+ * bandgap voltage with AVCC as reference. Repeated calls within the cache
+ * time return the previous measurement. Returns 0 when an external
+ * reference is selected, since AVCC can't be connected to AREF then.
+ */
+uint16_t readVcc(void)
+{
+  if(analog_reference == EXTERNAL)
+    return 0;
+  if(vcc_valid && internalCacheValid(vcc_timestamp))
+    return vcc_cached;
+
+  uint16_t adc = analogReadInternal(DEFAULT, BANDGAP_CHANNEL);
+  if(adc == 0)
+    return 0;
+
+  vcc_cached = (uint32_t)bandgap_millivolts * 1024UL / adc;
+  vcc_timestamp = millis();
+  vcc_valid = 1;
+  return vcc_cached;
+}
+
+#if defined(TEMPERATURE_CHANNEL)
+/* Returns the chip temperature in degrees Celsius. The sensor is typically
+ * accurate to within +-10 °C, which calibrateInternalSensors() can correct.
+ * Repeated calls within the cache time return the previous measurement.
+ * Returns 0 when an external reference is selected, since the internal
+ * reference can't be used then.
+ */
+int16_t readInternalTemperature(void)
+{
+  if(analog_reference == EXTERNAL)
+    return 0;
+  if(temperature_valid && internalCacheValid(temperature_timestamp))
+    return temperature_cached;
+
+  uint16_t adc = analogReadInternal(INTERNAL1V1, TEMPERATURE_CHANNEL);
+  int32_t millivolts = (uint32_t)adc * bandgap_millivolts / 1024UL;
+
+  temperature_cached = 25 + (millivolts - TEMPERATURE_MILLIVOLTS_25C) * 100 / TEMPERATURE_SLOPE_X100 + temperature_offset;
+  temperature_timestamp = millis();
+  temperature_valid = 1;
+  return temperature_cached;
+}
+#endif
+
+#endif
+
+
+/* High resolution PWM on the 16-bit timers */
+
+// Number of bits analogWrite() values have, set by analogWriteResolution()
+static uint8_t analog_write_bits = 8;
+
+#if defined(TCCR1A) && defined(ICR1) && defined(WGM13)
+
+// Stops the timer, sets the waveform generation mode, the top value and the
+// clock select bits, and starts it again from zero
+#define PWM_TIMER_CONFIG(n, wgm, cs, top)                                             \
+  TCCR##n##B = 0;                                                                     \
+  TCCR##n##A = (TCCR##n##A & ~(_BV(WGM##n##1) | _BV(WGM##n##0))) | ((wgm) & 0x03);     \
+  ICR##n = (top);                                                                     \
+  TCNT##n = 0;                                                                        \
+  TCCR##n##B = (((wgm) & 0x0c) << 1) | (cs)
+
+static uint8_t pwmTimerConfig(uint8_t timer, uint8_t wgm, uint8_t cs, uint16_t top)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+
+  switch(timer)
+  {
+    case TIMER1A:
+    case TIMER1B:
+      if(timer1_busy)
+      {
+        SREG = oldSREG;
+        return 0;
+      }
+      PWM_TIMER_CONFIG(1, wgm, cs, top);
+      break;
+
+    #if defined(TCCR3A) && defined(ICR3)
+    case TIMER3A:
+    case TIMER3B:
+      PWM_TIMER_CONFIG(3, wgm, cs, top);
+      break;
+    #endif
+
+    #if defined(TCCR4A) && defined(ICR4) && defined(WGM43)
+    case TIMER4A:
+    case TIMER4B:
+      PWM_TIMER_CONFIG(4, wgm, cs, top);
+      break;
+    #endif
+
+    default:
+      SREG = oldSREG;
+      return 0;
+  }
+
+  SREG = oldSREG;
+  return 1;
+}
+
+/* Sets the PWM frequency of the 16-bit timer the pin is connected to, in
+ * fast (PWM_FAST) or phase correct (PWM_PHASE_CORRECT) mode. The timer
+ * counts to ICRn, so the resolution is as high as the frequency allows.
+ * Both channels of the timer get the same frequency. Returns the actual
+ * frequency, or 0 if the pin isn't on a 16-bit timer, the frequency is out
+ * of range, or Timer1 is in use by tone(), the software PWM, the input
+ * capture functions or the cycle counter.
+ */
+unsigned long pwmSetup(uint8_t pin, unsigned long frequency, uint8_t mode)
+{
+  static const uint16_t prescalers[] = {1, 8, 64, 256, 1024};
+  uint8_t timer = digitalPinToTimer(pin);
+  uint32_t ticks = 0;
+  uint8_t cs = 0;
+
+  if(frequency == 0)
+    return 0;
+
+  // Fast PWM counts from 0 to top, phase correct PWM up to top and back down
+  uint8_t phaseCorrect = (mode == PWM_PHASE_CORRECT);
+  while(cs < 5)
+  {
+    uint32_t clock = (F_CPU >> phaseCorrect) / prescalers[cs];
+    ticks = (clock + frequency / 2) / frequency;
+    if(ticks <= 65535UL)
+      break;
+    cs++;
+  }
+  // At least 2 bits of resolution
+  if(cs == 5 || ticks < 4)
+    return 0;
+
+  uint16_t top = phaseCorrect ? ticks : ticks - 1;
+  if(!pwmTimerConfig(timer, phaseCorrect ? 10 : 14, cs + 1, top))
+    return 0;
+
+  return (F_CPU >> phaseCorrect) / prescalers[cs] / ticks;
+}
+
+/* Sets the number of bits of the analogWrite() value, from 8 to 16. Values
+ * are scaled down for the 8-bit timers. The 16-bit timers are switched to
+ * fast PWM with a top value that matches the resolution, so analogWrite()
+ * gives the full resolution on those pins, at F_CPU / 2^bits. A later
+ * pwmSetup() changes the frequency, and analogWrite() values are then
+ * scaled to the top value set by it. Going back to 8 bits restores the
+ * default 8-bit phase correct PWM. Returns 0 without changing anything
+ * while Timer1 is in use by another core function, see pwmSetup().
+ */
+uint8_t analogWriteResolution(uint8_t bits)
+{
+  if(timer1_busy)
+    return 0;
+
+  if(bits < 8)
+    bits = 8;
+  else if(bits > 16)
+    bits = 16;
+  analog_write_bits = bits;
+
+  // No prescaling for high resolution PWM. init() runs Timer1 at F_CPU/8
+  // below 8 MHz, and the other timers at F_CPU/64
+  uint8_t wgm = (bits == 8) ? 1 : 14;
+  uint8_t cs = (bits == 8) ? 3 : 1;
+  uint16_t top = 0xffff >> (16 - bits);
+
+  pwmTimerConfig(TIMER1A, wgm, (bits == 8 && F_CPU < 8000000L) ? 2 : cs, top);
+  #if defined(TCCR3A) && defined(ICR3)
+  pwmTimerConfig(TIMER3A, wgm, cs, top);
+  #endif
+  #if defined(TCCR4A) && defined(ICR4) && defined(WGM43)
+  pwmTimerConfig(TIMER4A, wgm, cs, top);
+  #endif
+  return 1;
+}
+
+// Scales an analogWrite() value to a timer that counts to ICRn. Mode 8 to
+// 15 all have the WGMn3 bit set, and analogWrite() only uses mode 10 and 14
+static uint16_t pwmScale(uint16_t value, uint16_t top)
+{
+  return ((uint32_t)value * ((uint32_t)top + 1)) >> analog_write_bits;
+}
+#endif
+
+// Compare register value for an analogWrite() value on a timer channel
+uint16_t analogWriteToDuty(uint8_t timer, uint16_t value)
+{
+  switch(timer)
+  {
+    #if defined(TCCR1A) && defined(ICR1) && defined(WGM13)
+    case TIMER1A:
+    case TIMER1B:
+      if(TCCR1B & _BV(WGM13))
+        return pwmScale(value, ICR1);
+      break;
+    #endif
+
+    #if defined(TCCR3A) && defined(ICR3)
+    case TIMER3A:
+    case TIMER3B:
+      if(TCCR3B & _BV(WGM33))
+        return pwmScale(value, ICR3);
+      break;
+    #endif
+
+    #if defined(TCCR4A) && defined(ICR4) && defined(WGM43)
+    case TIMER4A:
+    case TIMER4B:
+      if(TCCR4B & _BV(WGM43))
+        return pwmScale(value, ICR4);
+      break;
+    #endif
+  }
+
+  return value >> (analog_write_bits - 8);
+}
 
 // Right now, PWM output only works on the pins with
 // hardware support.  These are defined in the appropriate
@@ -99,17 +466,25 @@ void analogWrite(uint8_t pin, int val)
   // for consistenty with Wiring, which doesn't require a pinMode
   // call for the analog output pins.
   pinMode(pin, OUTPUT);
-  if (val == 0)
+
+  // Values above 32767 wrap around to negative numbers with a 16-bit
+  // resolution, so treat them as unsigned
+  uint16_t value = val;
+  uint16_t maxValue = 0xffff >> (16 - analog_write_bits);
+  if (value == 0)
   {
     digitalWrite(pin, LOW);
   }
-  else if (val == 255)
+  else if (value >= maxValue)
   {
     digitalWrite(pin, HIGH);
   }
   else
   {
-    switch(digitalPinToTimer(pin))
+    // The 8-bit timers get the upper 8 bits
+    val = value >> (analog_write_bits - 8);
+    uint8_t timer = digitalPinToTimer(pin);
+    switch(timer)
     {
       #if defined(TCCR0) && defined(COM01)
       case TIMER0:
@@ -146,7 +521,11 @@ void analogWrite(uint8_t pin, int val)
       case TIMER1A:
         // connect pwm to pin on timer 1, channel A
         TCCR1A |= _BV(COM1A1);
+        #if defined(ICR1) && defined(WGM13)
+        OCR1A = (TCCR1B & _BV(WGM13)) ? pwmScale(value, ICR1) : val; // set pwm duty
+        #else
         OCR1A = val; // set pwm duty
+        #endif
         break;
       #endif
 
@@ -154,7 +533,11 @@ void analogWrite(uint8_t pin, int val)
       case TIMER1B:
         // connect pwm to pin on timer 1, channel B
         TCCR1A |= _BV(COM1B1);
+        #if defined(ICR1) && defined(WGM13)
+        OCR1B = (TCCR1B & _BV(WGM13)) ? pwmScale(value, ICR1) : val; // set pwm duty
+        #else
         OCR1B = val; // set pwm duty
+        #endif
         break;
       #endif
 
@@ -177,16 +560,16 @@ void analogWrite(uint8_t pin, int val)
       #if defined(TCCR2A) && defined(COM2A1)
       case TIMER2A:
         // connect pwm to pin on timer 2, channel A
-        TCCR2A |= _BV(COM2A1);
-        OCR2A = val; // set pwm duty
+        timer2Write(TCCR2A, TCR2AUB, TCCR2A | _BV(COM2A1));
+        timer2Write(OCR2A, OCR2AUB, val); // set pwm duty
         break;
       #endif
 
       #if defined(TCCR2A) && defined(COM2B1)
       case TIMER2B:
         // connect pwm to pin on timer 2, channel B
-        TCCR2A |= _BV(COM2B1);
-        OCR2B = val; // set pwm duty
+        timer2Write(TCCR2A, TCR2AUB, TCCR2A | _BV(COM2B1));
+        timer2Write(OCR2B, OCR2BUB, val); // set pwm duty
         break;
       #endif
 
@@ -194,7 +577,11 @@ void analogWrite(uint8_t pin, int val)
       case TIMER3A:
         // connect pwm to pin on timer 3, channel A
         TCCR3A |= _BV(COM3A1);
+        #if defined(ICR3)
+        OCR3A = (TCCR3B & _BV(WGM33)) ? pwmScale(value, ICR3) : val; // set pwm duty
+        #else
         OCR3A = val; // set pwm duty
+        #endif
         break;
       #endif
 
@@ -207,7 +594,11 @@ void analogWrite(uint8_t pin, int val)
           PORTB |= _BV(PB7);
         #endif
         TCCR3A |= _BV(COM3B1);
+        #if defined(ICR3)
+        OCR3B = (TCCR3B & _BV(WGM33)) ? pwmScale(value, ICR3) : val; // set pwm duty
+        #else
         OCR3B = val; // set pwm duty
+        #endif
         break;
       #endif
 
@@ -226,7 +617,11 @@ void analogWrite(uint8_t pin, int val)
         #if defined(COM4A0)    // only used on 32U4
           TCCR4A &= ~_BV(COM4A0);
         #endif
+        #if defined(ICR4) && defined(WGM43)
+        OCR4A = (TCCR4B & _BV(WGM43)) ? pwmScale(value, ICR4) : val; // set pwm duty
+        #else
         OCR4A = val;  // set pwm duty
+        #endif
         break;
       #endif
       
@@ -239,7 +634,11 @@ void analogWrite(uint8_t pin, int val)
           PORTB |= _BV(PB7);
         #endif
         TCCR4A |= _BV(COM4B1);
+        #if defined(ICR4) && defined(WGM43)
+        OCR4B = (TCCR4B & _BV(WGM43)) ? pwmScale(value, ICR4) : val; // set pwm duty
+        #else
         OCR4B = val; // set pwm duty
+        #endif
         break;
       #endif
 
@@ -289,11 +688,12 @@ void analogWrite(uint8_t pin, int val)
 
       case NOT_ON_TIMER:
       default:
-        if (val < 128) {
+        if (value <= (maxValue >> 1)) {
           digitalWrite(pin, LOW);
         } else {
           digitalWrite(pin, HIGH);
         }
+        return;
     }
   }
 }
@@ -0,0 +1,150 @@
+/* wiring_analog_oversample.c
+|| Oversampling and decimation for 11 to 16 bit ADC results
+||
+|| For every extra bit of resolution, four times as many conversions are
+|| summed up. The conversions run back to back from the ADC interrupt, and
+|| the 32-bit sum is shifted right by the number of extra bits once all of
+|| them are done. This only adds real resolution if there's at least one
+|| LSB of noise on the input.
+||
+|| Each analog channel has its own request and result. Requests for several
+|| channels are served one after another, in channel order.
+||
+|| analogRead(), the ADC scanner and timer triggered sampling must not be
+|| used while an oversampled reading is in progress.
+*/
+
+#include "wiring_private.h"
+#include "pins_arduino.h"
+
+#if defined(ADC_vect) && defined(ADMUX) && defined(ADCSRA) && defined(NUM_ANALOG_INPUTS)
+
+#define OVERSAMPLE_MAX_EXTRA_BITS 6
+
+static uint8_t os_mux[NUM_ANALOG_INPUTS];
+static uint8_t os_extra_bits[NUM_ANALOG_INPUTS];
+static volatile uint16_t os_results[NUM_ANALOG_INPUTS];
+static volatile uint16_t os_pending; // Channels waiting for a result
+static volatile uint16_t os_ready;   // Channels with a result that hasn't been replaced
+
+static volatile uint8_t os_busy;
+static uint8_t os_channel;
+static uint16_t os_remaining;
+static uint32_t os_sum;
+
+static void analogOversampleConvert(uint8_t channel)
+{
+  os_channel = channel;
+  os_remaining = 1U << (2 * os_extra_bits[channel]);
+  os_sum = 0;
+
+  ADMUX = os_mux[channel];
+  ADCSRA |= _BV(ADIF) | _BV(ADIE) | _BV(ADSC);
+}
+
+static void analogOversampleHandler(void)
+{
+  os_sum += ADC;
+
+  if(--os_remaining)
+  {
+    ADCSRA |= _BV(ADSC);
+    return;
+  }
+
+  uint8_t channel = os_channel;
+  uint16_t mask = 1U << channel;
+  os_results[channel] = os_sum >> os_extra_bits[channel];
+  os_pending &= ~mask;
+  os_ready |= mask;
+
+  // Move on to the next channel that's waiting, if any
+  uint16_t pending = os_pending;
+  if(pending)
+  {
+    channel = 0;
+    while(!(pending & 0x01))
+    {
+      pending >>= 1;
+      channel++;
+    }
+    analogOversampleConvert(channel);
+  }
+  else
+  {
+    ADCSRA &= ~_BV(ADIE);
+    os_busy = 0;
+  }
+}
+
+static uint8_t analogOversampleChannel(uint8_t pin)
+{
+#ifdef analogPinToChannel
+  pin = analogPinToChannel(pin);
+#endif
+  return pin;
+}
+
+void analogOversampleStart(uint8_t pin, uint8_t bits)
+{
+  uint8_t channel = analogOversampleChannel(pin);
+  if(channel >= NUM_ANALOG_INPUTS)
+    return;
+
+  uint8_t extraBits = (bits > 10) ? bits - 10 : 0;
+  if(extraBits > OVERSAMPLE_MAX_EXTRA_BITS)
+    extraBits = OVERSAMPLE_MAX_EXTRA_BITS;
+
+  uint8_t oldSREG = SREG;
+  cli();
+
+  uint16_t mask = 1U << channel;
+  if(!(os_pending & mask))
+  {
+    // The sum needs the right adjusted 10-bit result, regardless of analogReadResolution()
+    os_mux[channel] = (analog_reference << 6) | (channel & 0x07);
+    os_extra_bits[channel] = extraBits;
+    os_ready &= ~mask;
+    os_pending |= mask;
+
+    if(!os_busy)
+    {
+      os_busy = 1;
+      adc_handler = analogOversampleHandler;
+      analogOversampleConvert(channel);
+    }
+  }
+
+  SREG = oldSREG;
+}
+
+uint8_t analogOversampleReady(uint8_t pin)
+{
+  uint8_t channel = analogOversampleChannel(pin);
+  if(channel >= NUM_ANALOG_INPUTS)
+    return 0;
+
+  return (os_ready & (1U << channel)) ? 1 : 0;
+}
+
+uint16_t analogOversampleResult(uint8_t pin)
+{
+  uint8_t channel = analogOversampleChannel(pin);
+  if(channel >= NUM_ANALOG_INPUTS)
+    return 0;
+
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t result = os_results[channel];
+  SREG = oldSREG;
+  return result;
+}
+
+uint16_t analogReadOversampled(uint8_t pin, uint8_t bits)
+{
+  analogOversampleStart(pin, bits);
+  while(!analogOversampleReady(pin) && os_busy);
+  return analogOversampleResult(pin);
+}
+
+#endif
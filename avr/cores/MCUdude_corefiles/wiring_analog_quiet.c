@@ -0,0 +1,76 @@
+/* wiring_analog_quiet.c
+|| ADC conversions in ADC noise reduction sleep mode
+||
+|| The CPU and the I/O clock are halted while the ADC converts, which takes
+|| the digital switching noise out of the measurement and saves power.
+|| The ADC conversion complete interrupt wakes the CPU up again.
+||
+|| Note that Timer0 is clocked by the halted I/O clock, so millis() and
+|| micros() fall behind by up to one conversion time per reading.
+*/
+
+#include "wiring_private.h"
+#include "pins_arduino.h"
+#include <avr/sleep.h>
+
+#if defined(ADC_vect) && defined(ADMUX) && defined(ADCSRA) && defined(SLEEP_MODE_ADC)
+
+#if defined(SMCR)
+  #define QUIET_SLEEP_REG SMCR
+#else
+  #define QUIET_SLEEP_REG MCUCR
+#endif
+#define QUIET_SLEEP_MODE_MASK (_BV(SM2) | _BV(SM1) | _BV(SM0))
+
+static volatile uint8_t quiet_done;
+
+static void analogQuietHandler(void)
+{
+  quiet_done = 1;
+}
+
+int analogReadQuiet(uint8_t pin)
+{
+  // Nothing could wake the CPU up with interrupts or the ADC disabled
+  if(!(SREG & _BV(SREG_I)) || !(ADCSRA & _BV(ADEN)))
+    return analogRead(pin);
+
+#ifdef analogPinToChannel
+  pin = analogPinToChannel(pin);
+#endif
+
+  // The conversion starts when the CPU is halted, so the ADC must be idle
+  while(ADCSRA & _BV(ADSC));
+
+  cli();
+
+  ADMUX = analogChannelToMux(pin);
+  quiet_done = 0;
+  adc_handler = analogQuietHandler;
+  ADCSRA |= _BV(ADIF) | _BV(ADIE);
+
+  uint8_t sleepMode = QUIET_SLEEP_REG & QUIET_SLEEP_MODE_MASK;
+  set_sleep_mode(SLEEP_MODE_ADC);
+
+  // Any other interrupt that fires during the conversion wakes the CPU up as
+  // well. The conversion carries on meanwhile, so just go back to sleep. SEI
+  // always executes the next instruction first, so the ADC interrupt can't
+  // slip in between the check and SLEEP
+  while(!quiet_done)
+  {
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+    cli();
+  }
+
+  ADCSRA &= ~_BV(ADIE);
+  QUIET_SLEEP_REG = (QUIET_SLEEP_REG & ~QUIET_SLEEP_MODE_MASK) | sleepMode;
+
+  sei();
+
+  return analogConversionResult();
+}
+
+#endif
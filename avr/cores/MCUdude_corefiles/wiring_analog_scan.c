@@ -0,0 +1,156 @@
+/* wiring_analog_scan.c
+|| Interrupt driven round-robin ADC scanner
+||
+|| The ADC runs in free running mode and converts the channels in the scan
+|| list one after another. Each result is stored in a table that holds the
+|| latest value of every channel, and optionally in a sample ring buffer.
+|| Reading a cached value only takes a few cycles, where analogRead() waits
+|| ~104 us for a conversion with the default 125 kHz ADC clock.
+||
+|| analogRead() must not be used while a scan is running.
+*/
+
+#include "wiring_private.h"
+#include "pins_arduino.h"
+
+#if defined(ADC_vect) && defined(ADMUX) && defined(ADCSRA)
+
+#if defined(ADATE)
+  #define ADC_FREE_RUNNING ADATE
+#else
+  #define ADC_FREE_RUNNING ADFR
+#endif
+
+static uint8_t scan_mux[ANALOG_SCAN_MAX_CHANNELS];
+static volatile uint16_t scan_values[ANALOG_SCAN_MAX_CHANNELS];
+static uint8_t scan_count;
+static uint8_t scan_result_index; // Scan list index of the conversion that completes next
+static uint8_t scan_mux_index;    // Scan list index currently selected in ADMUX
+
+static analog_sample_t *scan_buffer;
+static uint8_t scan_buffer_size;
+static volatile uint8_t scan_buffer_head;
+static volatile uint8_t scan_buffer_tail;
+
+static void analogScanHandler(void)
+{
+  uint16_t value = analogConversionResult();
+  uint8_t index = scan_result_index;
+
+  scan_values[index] = value;
+
+  // Samples are dropped when the ring buffer is full
+  if(scan_buffer)
+  {
+    uint8_t head = scan_buffer_head;
+    uint8_t next = head + 1;
+    if(next == scan_buffer_size)
+      next = 0;
+    if(next != scan_buffer_tail)
+    {
+      scan_buffer[head].index = index;
+      scan_buffer[head].value = value;
+      scan_buffer_head = next;
+    }
+  }
+
+  // In free running mode the next conversion has already started with the
+  // channel that was selected before. Select the channel for the one after
+  scan_result_index = scan_mux_index;
+  if(++scan_mux_index == scan_count)
+    scan_mux_index = 0;
+  ADMUX = scan_mux[scan_mux_index];
+}
+
+void analogScanBegin(const uint8_t *pins, uint8_t count)
+{
+  analogScanEnd();
+
+  if(count > ANALOG_SCAN_MAX_CHANNELS)
+    count = ANALOG_SCAN_MAX_CHANNELS;
+  if(count == 0)
+    return;
+
+  for(uint8_t i = 0; i < count; i++)
+  {
+    uint8_t channel = pins[i];
+  #ifdef analogPinToChannel
+    channel = analogPinToChannel(channel);
+  #endif
+    scan_mux[i] = analogChannelToMux(channel);
+    scan_values[i] = 0;
+  }
+
+  uint8_t oldSREG = SREG;
+  cli();
+
+  scan_count = count;
+  scan_result_index = 0;
+  scan_mux_index = 0;
+  scan_buffer_head = scan_buffer_tail = 0;
+  adc_handler = analogScanHandler;
+
+  ADMUX = scan_mux[0];
+#if defined(ADCSRB) && defined(ADTS0)
+  ADCSRB &= ~(_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0));
+#endif
+  // Writing ADIF clears any stale conversion complete flag
+  ADCSRA |= _BV(ADIF) | _BV(ADIE) | _BV(ADC_FREE_RUNNING) | _BV(ADSC);
+
+  SREG = oldSREG;
+}
+
+void analogScanEnd(void)
+{
+  if(adc_handler != analogScanHandler)
+    return;
+
+  ADCSRA &= ~(_BV(ADC_FREE_RUNNING) | _BV(ADIE));
+  while(ADCSRA & _BV(ADSC));
+  ADCSRA |= _BV(ADIF);
+  scan_count = 0;
+}
+
+int analogScanRead(uint8_t index)
+{
+  if(index >= scan_count)
+    return 0;
+
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t value = scan_values[index];
+  SREG = oldSREG;
+  return value;
+}
+
+void analogScanBuffer(analog_sample_t *buffer, uint8_t size)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  scan_buffer = (size >= 2) ? buffer : NULL;
+  scan_buffer_size = size;
+  scan_buffer_head = scan_buffer_tail = 0;
+  SREG = oldSREG;
+}
+
+uint8_t analogScanAvailable(void)
+{
+  uint8_t head = scan_buffer_head;
+  uint8_t tail = scan_buffer_tail;
+  return (head >= tail) ? head - tail : scan_buffer_size - tail + head;
+}
+
+uint8_t analogScanNext(analog_sample_t *sample)
+{
+  uint8_t tail = scan_buffer_tail;
+  if(tail == scan_buffer_head)
+    return 0;
+
+  *sample = scan_buffer[tail];
+  if(++tail == scan_buffer_size)
+    tail = 0;
+  scan_buffer_tail = tail;
+  return 1;
+}
+
+#endif
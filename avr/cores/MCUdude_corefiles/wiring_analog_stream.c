@@ -0,0 +1,252 @@
+/* wiring_analog_stream.c
+|| Timer triggered ADC sampling at a fixed rate
+||
+|| The ADC is started by a timer compare match through the auto trigger
+|| logic, so the sample period is set by hardware and doesn't depend on
+|| interrupt latency or on what loop() is doing. The samples are streamed
+|| into a double buffer. Once a half is full it is handed over to a callback
+|| or picked up by analogStreamBlock(), while the other half is being filled.
+|| The callbacks run with interrupts enabled, and must be done with their
+|| block before the other half is full. If not, an overrun is counted.
+||
+|| Timer1 compare match B can trigger at almost any rate. Timer1 runs in CTC
+|| mode while streaming, so PWM on the Timer1 pins doesn't work meanwhile.
+|| Timer0 compare match A keeps the Timer0 setup millis() relies on, so
+|| the rate is fixed to one sample per Timer0 overflow (F_CPU / 16384).
+||
+|| The ADC clock is raised as needed to fit a conversion in a sample period.
+|| Above 200 kHz ADC clock (above ~15 ksps) the resolution gradually drops.
+||
+|| analogRead() and the ADC scanner must not be used while streaming.
+*/
+
+#include "wiring_private.h"
+#include "pins_arduino.h"
+
+#if defined(ADC_vect) && defined(ADCSRB) && defined(ADTS0) && defined(ADATE)
+
+static uint16_t *stream_buffer;
+static uint16_t stream_block_size;
+static uint16_t stream_index;
+static void (*stream_half_callback)(uint16_t *block);
+static void (*stream_full_callback)(uint16_t *block);
+static uint16_t *volatile stream_pending;
+static volatile uint16_t stream_overruns;
+static volatile uint8_t stream_in_callback;
+
+// The compare match flag must be cleared for the next one to trigger the ADC
+static volatile uint8_t *stream_trigger_flags;
+static uint8_t stream_trigger_mask;
+
+// Settings to restore when streaming stops
+static uint8_t saved_adcsra;
+static uint8_t saved_tccr1a;
+static uint8_t saved_tccr1b;
+static uint16_t saved_ocr1a;
+static uint16_t saved_ocr1b;
+static uint8_t stream_trigger;
+static uint8_t stream_running;
+
+static void analogStreamBlockDone(uint16_t *block)
+{
+  // The ADC is about to overwrite the other block, which hasn't been picked
+  // up yet or is still being processed by a callback
+  if(stream_pending || stream_in_callback)
+    stream_overruns++;
+  stream_pending = block;
+
+  if(stream_in_callback || (!stream_half_callback && !stream_full_callback))
+    return;
+
+  // Run the callbacks with interrupts enabled, so sampling continues in the
+  // meantime. A block that completes during a callback is handled after it
+  stream_in_callback = 1;
+  while((block = stream_pending))
+  {
+    stream_pending = NULL;
+    void (*callback)(uint16_t *) = (block == stream_buffer) ? stream_half_callback : stream_full_callback;
+    if(callback)
+    {
+      sei();
+      callback(block);
+      cli();
+    }
+  }
+  stream_in_callback = 0;
+}
+
+static void analogStreamHandler(void)
+{
+  *stream_trigger_flags = stream_trigger_mask;
+
+  uint16_t index = stream_index;
+  stream_buffer[index++] = analogConversionResult();
+
+  if(index == 2 * stream_block_size)
+    index = 0;
+  stream_index = index;
+
+  if(index == stream_block_size)
+    analogStreamBlockDone(stream_buffer);
+  else if(index == 0)
+    analogStreamBlockDone(stream_buffer + stream_block_size);
+}
+
+void analogStreamBuffer(uint16_t *buffer, uint16_t blockSize)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  stream_buffer = buffer;
+  stream_block_size = blockSize;
+  stream_index = 0;
+  stream_pending = NULL;
+  SREG = oldSREG;
+}
+
+void analogStreamCallbacks(void (*half)(uint16_t *block), void (*full)(uint16_t *block))
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  stream_half_callback = half;
+  stream_full_callback = full;
+  SREG = oldSREG;
+}
+
+unsigned long analogStreamBegin(uint8_t pin, unsigned long rate, uint8_t trigger)
+{
+  static const uint16_t timer1_prescalers[] = {1, 8, 64, 256, 1024};
+  uint8_t cs = 0;
+  uint32_t ticks = 0;
+
+  analogStreamEnd();
+
+  if(stream_buffer == NULL || stream_block_size == 0)
+    return 0;
+
+  if(trigger == ADC_TRIGGER_TIMER0)
+    rate = F_CPU / (64UL * 256UL);
+  else
+  {
+    if(rate == 0)
+      return 0;
+
+    // Pick the smallest Timer1 prescaler that fits the period in 16 bits
+    while(cs < 5)
+    {
+      ticks = (F_CPU / timer1_prescalers[cs] + rate / 2) / rate;
+      if(ticks <= 65536UL)
+        break;
+      cs++;
+    }
+    if(cs == 5 || ticks < 2)
+      return 0;
+    rate = F_CPU / timer1_prescalers[cs] / ticks;
+  }
+
+  // Pick the slowest ADC clock that fits a conversion (13.5 ADC clocks when
+  // auto triggered) in one sample period
+  uint32_t period = F_CPU / rate;
+  uint8_t adps = 7;
+  while(adps > 1 && (14UL << adps) > period)
+    adps--;
+  if((14UL << adps) > period)
+    return 0;
+
+#ifdef analogPinToChannel
+  pin = analogPinToChannel(pin);
+#endif
+
+  uint8_t oldSREG = SREG;
+  cli();
+
+  saved_adcsra = ADCSRA;
+  stream_running = 1;
+  stream_trigger = trigger;
+  stream_index = 0;
+  stream_pending = NULL;
+  stream_overruns = 0;
+  adc_handler = analogStreamHandler;
+
+  ADMUX = analogChannelToMux(pin);
+  if(trigger == ADC_TRIGGER_TIMER0)
+  {
+    stream_trigger_flags = &TIFR0;
+    stream_trigger_mask = _BV(OCF0A);
+    ADCSRB = (ADCSRB & ~(_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0))) | _BV(ADTS1) | _BV(ADTS0);
+  }
+  else
+  {
+    saved_tccr1a = TCCR1A;
+    saved_tccr1b = TCCR1B;
+    saved_ocr1a = OCR1A;
+    saved_ocr1b = OCR1B;
+
+    // CTC mode with OCR1A as top. Compare match B at the start of each period
+    TCCR1B = 0;
+    TCCR1A = 0;
+    TCNT1 = 0;
+    OCR1A = ticks - 1;
+    OCR1B = 0;
+    stream_trigger_flags = &TIFR1;
+    stream_trigger_mask = _BV(OCF1B);
+    ADCSRB = (ADCSRB & ~(_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0))) | _BV(ADTS2) | _BV(ADTS0);
+  }
+
+  *stream_trigger_flags = stream_trigger_mask;
+  ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIF) | _BV(ADIE) | adps;
+
+  if(trigger != ADC_TRIGGER_TIMER0)
+    TCCR1B = _BV(WGM12) | (cs + 1);
+
+  SREG = oldSREG;
+
+  return rate;
+}
+
+void analogStreamEnd(void)
+{
+  if(!stream_running)
+    return;
+
+  uint8_t oldSREG = SREG;
+  cli();
+
+  ADCSRA &= ~(_BV(ADATE) | _BV(ADIE));
+  if(stream_trigger != ADC_TRIGGER_TIMER0)
+  {
+    TCCR1B = 0;
+    OCR1A = saved_ocr1a;
+    OCR1B = saved_ocr1b;
+    TCNT1 = 0;
+    TCCR1A = saved_tccr1a;
+    TCCR1B = saved_tccr1b;
+  }
+  ADCSRB &= ~(_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0));
+  stream_running = 0;
+
+  SREG = oldSREG;
+
+  while(ADCSRA & _BV(ADSC));
+  ADCSRA = saved_adcsra | _BV(ADIF);
+}
+
+uint16_t *analogStreamBlock(void)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t *block = stream_pending;
+  stream_pending = NULL;
+  SREG = oldSREG;
+  return block;
+}
+
+uint16_t analogStreamOverruns(void)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t overruns = stream_overruns;
+  SREG = oldSREG;
+  return overruns;
+}
+
+#endif
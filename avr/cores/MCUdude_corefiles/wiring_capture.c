@@ -0,0 +1,215 @@
+/* wiring_capture.c
+|| Pulse width measurement using the Timer1 input capture unit
+||
+|| The edges on the ICP1 pin are timestamped by the hardware with a
+|| resolution of one clock cycle (62.5 ns at 16 MHz), regardless of what
+|| other interrupts are doing. Timer1 overflows extend the 16-bit capture
+|| value to 32 bits, which allows pulses of up to 2^32 clock cycles.
+||
+|| Timer1 is reconfigured while a measurement is in progress, and restored
+|| when it's done or stopped. PWM on the Timer1 pins doesn't work meanwhile.
+*/
+
+#include "wiring_private.h"
+
+#if defined(ICR1) && defined(TIMER1_CAPT_vect) && defined(TIMER1_OVF_vect)
+
+#if defined(TIMSK1)
+  #define CAPTURE_TIMSK TIMSK1
+  #define CAPTURE_TIFR  TIFR1
+  #define CAPTURE_ICIE  ICIE1
+#else
+  #define CAPTURE_TIMSK TIMSK
+  #define CAPTURE_TIFR  TIFR
+  #define CAPTURE_ICIE  TICIE1
+#endif
+
+enum
+{
+  CAPTURE_IDLE,
+  CAPTURE_WAIT_START,
+  CAPTURE_WAIT_END,
+  CAPTURE_DONE
+};
+
+static volatile uint8_t capture_state = CAPTURE_IDLE;
+static volatile uint16_t capture_overflows;
+static volatile uint32_t capture_start;
+static volatile uint32_t capture_ticks;
+static void (*volatile capture_callback)(unsigned long);
+
+// Timer1 settings and overflow handler to restore when the measurement is
+// done. Only the Timer1 capture and overflow bits of the shared interrupt
+// mask register are saved
+#define CAPTURE_INT_MASK (_BV(CAPTURE_ICIE) | _BV(TOIE1))
+static uint8_t saved_tccr1a;
+static uint8_t saved_tccr1b;
+static uint8_t saved_timsk;
+static voidFuncPtr saved_ovf_handler;
+
+static void captureOverflowHandler(void)
+{
+  capture_overflows++;
+}
+
+static void captureRestoreTimer(void)
+{
+  CAPTURE_TIMSK = (CAPTURE_TIMSK & ~CAPTURE_INT_MASK) | saved_timsk;
+  timer1_ovf_handler = saved_ovf_handler;
+  TCCR1A = saved_tccr1a;
+  TCCR1B = saved_tccr1b;
+  timer1_busy &= ~TIMER1_BUSY_CAPTURE;
+}
+
+void pulseCaptureStart(uint8_t state, void (*callback)(unsigned long))
+{
+  uint8_t oldSREG = SREG;
+  cli();
+
+  if(capture_state == CAPTURE_IDLE || capture_state == CAPTURE_DONE)
+  {
+    saved_tccr1a = TCCR1A;
+    saved_tccr1b = TCCR1B;
+    saved_timsk = CAPTURE_TIMSK & CAPTURE_INT_MASK;
+    saved_ovf_handler = timer1_ovf_handler;
+  }
+
+  capture_callback = callback;
+  capture_overflows = 0;
+  capture_state = CAPTURE_WAIT_START;
+
+  // Normal mode, no prescaling, noise canceler on. Capture the edge that
+  // starts the pulse first
+  TCCR1A = 0;
+  TCCR1B = _BV(ICNC1) | (state ? _BV(ICES1) : 0) | _BV(CS10);
+  TCNT1 = 0;
+
+  timer1_ovf_handler = captureOverflowHandler;
+  CAPTURE_TIFR = _BV(ICF1) | _BV(TOV1);
+  CAPTURE_TIMSK |= CAPTURE_INT_MASK;
+  timer1_busy |= TIMER1_BUSY_CAPTURE;
+
+  SREG = oldSREG;
+}
+
+void pulseCaptureStop(void)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  if(capture_state == CAPTURE_WAIT_START || capture_state == CAPTURE_WAIT_END)
+  {
+    captureRestoreTimer();
+    capture_state = CAPTURE_IDLE;
+  }
+  SREG = oldSREG;
+}
+
+uint8_t pulseCaptureDone(void)
+{
+  return capture_state == CAPTURE_DONE;
+}
+
+unsigned long pulseCaptureTicks(void)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned long ticks = capture_ticks;
+  SREG = oldSREG;
+  return ticks;
+}
+
+// Splitting the division keeps the intermediate results within 32 bits,
+// and is exact for clocks that aren't a whole number of MHz too
+unsigned long pulseCaptureMicros(void)
+{
+  unsigned long ticks = pulseCaptureTicks();
+  return (ticks / (F_CPU / 1000UL)) * 1000UL + ((ticks % (F_CPU / 1000UL)) * 1000UL) / (F_CPU / 1000UL);
+}
+
+// Clock cycles since pulseCaptureStart(), read while Timer1 still counts
+// for the measurement
+static unsigned long captureElapsed(void)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t t = TCNT1;
+  uint16_t overflows = capture_overflows;
+  if((CAPTURE_TIFR & _BV(TOV1)) && t < 0x8000)
+    overflows++;
+  SREG = oldSREG;
+
+  return ((uint32_t)overflows << 16) | t;
+}
+
+/* Same as pulseIn(), but measured by the input capture unit on the ICP1 pin.
+ * Returns the pulse length in microseconds, or 0 if no complete pulse was
+ * seen within timeout microseconds. Interrupts must be enabled.
+ *
+ * The timeout is counted in Timer1 clock cycles rather than with micros(),
+ * so it works without millis() too. The 32-bit count wraps after 268 s at
+ * 16 MHz, so the loop counts the wraps itself, and the whole timeout range
+ * works.
+ */
+unsigned long pulseInCapture(uint8_t state, unsigned long timeout)
+{
+  // Split so that only the product needs 64 bits
+  uint64_t limit = (uint64_t)(timeout / 1000UL) * (F_CPU / 1000UL) + ((timeout % 1000UL) * (F_CPU / 1000UL)) / 1000UL;
+  unsigned long last = 0;
+  uint16_t wraps = 0;
+
+  pulseCaptureStart(state, NULL);
+
+  for(;;)
+  {
+    // Once the measurement is done, Timer1 is restored and the count means
+    // nothing, so it's checked after reading it
+    unsigned long elapsed = captureElapsed();
+    if(pulseCaptureDone())
+      break;
+    if(elapsed < last)
+      wraps++;
+    last = elapsed;
+    if((((uint64_t)wraps << 32) | elapsed) > limit)
+    {
+      pulseCaptureStop();
+      return 0;
+    }
+  }
+
+  capture_state = CAPTURE_IDLE;
+  return pulseCaptureMicros();
+}
+
+ISR(TIMER1_CAPT_vect)
+{
+  uint16_t icr = ICR1;
+  uint16_t overflows = capture_overflows;
+
+  // An overflow that happened just before the capture hasn't been counted yet
+  if((CAPTURE_TIFR & _BV(TOV1)) && icr < 0x8000)
+    overflows++;
+
+  uint32_t timestamp = ((uint32_t)overflows << 16) | icr;
+
+  if(capture_state == CAPTURE_WAIT_START)
+  {
+    capture_start = timestamp;
+    capture_state = CAPTURE_WAIT_END;
+
+    // Capture the opposite edge next. Changing the edge may set ICF1
+    TCCR1B ^= _BV(ICES1);
+    CAPTURE_TIFR = _BV(ICF1);
+  }
+  else if(capture_state == CAPTURE_WAIT_END)
+  {
+    capture_ticks = timestamp - capture_start;
+    capture_state = CAPTURE_DONE;
+    captureRestoreTimer();
+
+    void (*callback)(unsigned long) = capture_callback;
+    if(callback)
+      callback(capture_ticks);
+  }
+}
+
+#endif
@@ -0,0 +1,170 @@
+/* wiring_comparator.c
+|| Analog comparator with interrupt driven edge detection
+||
+|| The comparator compares the voltage on AIN0 (or the internal bandgap
+|| reference) with the voltage on AIN1 (or one of the analog pins through
+|| the ADC multiplexer), and flips its output within a few hundred
+|| nanoseconds. An interrupt on the rising edge, the falling edge or both
+|| runs a callback, and the output can be routed to the Timer1 input
+|| capture unit to timestamp the edges in hardware.
+||
+|| The ADC multiplexer can only feed the comparator while the ADC is turned
+|| off, so analogRead() must not be used while an analog pin is selected as
+|| negative input.
+*/
+
+#include "wiring_private.h"
+#include "pins_arduino.h"
+
+#if defined(ACSR) && defined(ACME)
+
+#if defined(ANALOG_COMP_vect)
+  #define COMPARATOR_vect ANALOG_COMP_vect
+#else
+  #define COMPARATOR_vect ANA_COMP_vect
+#endif
+
+// ACME is in ADCSRB on newer parts, and in SFIOR on the ATmega8
+#if defined(ADCSRB)
+  #define COMPARATOR_ACME_REG ADCSRB
+#else
+  #define COMPARATOR_ACME_REG SFIOR
+#endif
+
+#define COMPARATOR_MODE_MASK (_BV(ACIS1) | _BV(ACIS0))
+
+static void (*volatile comparator_callback)(void);
+static uint8_t comparator_running;
+static uint8_t saved_aden;
+#if defined(DIDR1)
+static uint8_t saved_didr1;
+#endif
+
+void analogComparatorBegin(uint8_t positive, uint8_t negative)
+{
+  analogComparatorEnd();
+
+  uint8_t oldSREG = SREG;
+  cli();
+
+  saved_aden = ADCSRA & _BV(ADEN);
+#if defined(DIDR1)
+  saved_didr1 = DIDR1 & (_BV(AIN1D) | _BV(AIN0D));
+#endif
+
+  if(negative == ANALOG_COMPARATOR_AIN1)
+  {
+    COMPARATOR_ACME_REG &= ~_BV(ACME);
+  #if defined(DIDR1)
+    DIDR1 |= _BV(AIN1D);
+  #endif
+  }
+  else
+  {
+  #ifdef analogPinToChannel
+    negative = analogPinToChannel(negative);
+  #endif
+    // Wait for a conversion in progress before turning the ADC off
+    while(ADCSRA & _BV(ADSC));
+    ADCSRA &= ~_BV(ADEN);
+    ADMUX = (ADMUX & ~(_BV(MUX3) | _BV(MUX2) | _BV(MUX1) | _BV(MUX0))) | (negative & 0x07);
+    COMPARATOR_ACME_REG |= _BV(ACME);
+  }
+
+#if defined(DIDR1)
+  if(positive == ANALOG_COMPARATOR_AIN0)
+    DIDR1 |= _BV(AIN0D);
+#endif
+
+  // Turning the comparator on may set the interrupt flag
+  ACSR = (positive == ANALOG_COMPARATOR_BANDGAP) ? _BV(ACBG) : 0;
+  ACSR |= _BV(ACI);
+  comparator_running = 1;
+
+  SREG = oldSREG;
+}
+
+void analogComparatorEnd(void)
+{
+  if(!comparator_running)
+    return;
+
+  uint8_t oldSREG = SREG;
+  cli();
+
+  // The interrupt must be disabled before the comparator is turned off
+  ACSR &= ~(_BV(ACIE) | _BV(ACIC));
+  ACSR = _BV(ACD) | _BV(ACI);
+  comparator_callback = NULL;
+
+  COMPARATOR_ACME_REG &= ~_BV(ACME);
+  ADCSRA |= saved_aden;
+#if defined(DIDR1)
+  DIDR1 = (DIDR1 & ~(_BV(AIN1D) | _BV(AIN0D))) | saved_didr1;
+#endif
+  comparator_running = 0;
+
+  SREG = oldSREG;
+}
+
+uint8_t analogComparatorRead(void)
+{
+  return (ACSR & _BV(ACO)) ? HIGH : LOW;
+}
+
+/* Runs callback from the comparator interrupt when the output rises
+ * (RISING), falls (FALLING) or does either (CHANGE). The output is high when
+ * the positive input is above the negative input.
+ */
+void analogComparatorAttachInterrupt(void (*callback)(void), uint8_t mode)
+{
+  // ACIS1:0 is 0b00 for any change, 0b10 for falling and 0b11 for rising
+  uint8_t acis = (mode == FALLING) ? _BV(ACIS1) : (mode == RISING) ? _BV(ACIS1) | _BV(ACIS0) : 0;
+
+  uint8_t oldSREG = SREG;
+  cli();
+
+  // Changing the edge may set the interrupt flag, so the interrupt has to be
+  // off meanwhile
+  comparator_callback = callback;
+  ACSR &= ~_BV(ACIE);
+  ACSR = (ACSR & ~COMPARATOR_MODE_MASK) | acis;
+  ACSR |= _BV(ACI);
+  if(callback)
+    ACSR |= _BV(ACIE);
+
+  SREG = oldSREG;
+}
+
+void analogComparatorDetachInterrupt(void)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  ACSR &= ~_BV(ACIE);
+  comparator_callback = NULL;
+  SREG = oldSREG;
+}
+
+/* Connects the comparator output to the Timer1 input capture unit instead
+ * of the ICP1 pin, so pulseInCapture() and pulseCaptureStart() measure the
+ * comparator output.
+ */
+void analogComparatorInputCapture(uint8_t enable)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  if(enable)
+    ACSR |= _BV(ACIC);
+  else
+    ACSR &= ~_BV(ACIC);
+  SREG = oldSREG;
+}
+
+ISR(COMPARATOR_vect)
+{
+  void (*callback)(void) = comparator_callback;
+  if(callback)
+    callback();
+}
+
+#endif
@@ -0,0 +1,147 @@
+/* wiring_cycles.c
+|| 64-bit cycle counter on a free running Timer1
+||
+|| Timer1 counts in normal mode at the full clock or clock / 8, and its
+|| overflow interrupt extends the 16-bit count to 64 bits. The overflow
+|| interrupt only increments a counter, so it takes a few cycles once every
+|| 65536 ticks. A count is read the same way as micros() does, with a check
+|| for an overflow that is pending but not counted yet.
+||
+|| cycleTicks() returns the low 32 bits of the count without any conversion,
+|| for comparing timestamps in hot code. cycles64() and micros64() convert
+|| the full count, and don't wrap within the lifetime of the chip.
+||
+|| Timer1 is reconfigured while the counter runs, and restored by cyclesEnd().
+|| PWM on the Timer1 pins, Servo, the Timer1 tones, the software PWM and the
+|| input capture functions don't work meanwhile, and analogWriteResolution()
+|| and pwmSetup() refuse to change Timer1.
+*/
+
+#include "wiring_private.h"
+
+#if defined(TCCR1A) && defined(TCNT1) && defined(TIMER1_OVF_vect)
+
+#if defined(TIMSK1)
+  #define CYCLES_TIMSK TIMSK1
+  #define CYCLES_TIFR  TIFR1
+#else
+  #define CYCLES_TIMSK TIMSK
+  #define CYCLES_TIFR  TIFR
+#endif
+
+// Overflows of the 16-bit count. Together with the count they make 64 bits
+static volatile uint32_t cycles_overflows;
+static volatile uint16_t cycles_overflows_high;
+static uint8_t cycles_shift; // Ticks to clock cycles, 0 or 3
+
+static uint8_t saved_tccr1a;
+static uint8_t saved_tccr1b;
+static uint8_t saved_toie;
+static voidFuncPtr saved_ovf_handler;
+
+static void cyclesOverflowHandler(void)
+{
+  if(++cycles_overflows == 0)
+    cycles_overflows_high++;
+}
+
+/* Starts counting from zero, with one tick per clock cycle, or one tick per
+ * eight clock cycles if prescaler is CYCLES_CLOCK_DIV8.
+ */
+void cyclesBegin(uint8_t prescaler)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+
+  saved_tccr1a = TCCR1A;
+  saved_tccr1b = TCCR1B;
+  saved_toie = CYCLES_TIMSK & _BV(TOIE1);
+  saved_ovf_handler = timer1_ovf_handler;
+
+  cycles_overflows = 0;
+  cycles_overflows_high = 0;
+  cycles_shift = prescaler == CYCLES_CLOCK_DIV8 ? 3 : 0;
+
+  // Normal mode
+  TCCR1A = 0;
+  TCCR1B = prescaler == CYCLES_CLOCK_DIV8 ? _BV(CS11) : _BV(CS10);
+  TCNT1 = 0;
+
+  timer1_ovf_handler = cyclesOverflowHandler;
+  CYCLES_TIFR = _BV(TOV1);
+  CYCLES_TIMSK |= _BV(TOIE1);
+  timer1_busy |= TIMER1_BUSY_CYCLES;
+
+  SREG = oldSREG;
+}
+
+// Stops the counter, and puts Timer1 back the way it was
+void cyclesEnd(void)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  CYCLES_TIMSK = (CYCLES_TIMSK & ~_BV(TOIE1)) | saved_toie;
+  timer1_ovf_handler = saved_ovf_handler;
+  TCCR1A = saved_tccr1a;
+  TCCR1B = saved_tccr1b;
+  timer1_busy &= ~TIMER1_BUSY_CYCLES;
+  SREG = oldSREG;
+}
+
+// Reads the overflow count and the timer count consistently. The timer
+// count is read first, so an overflow flag found set belongs to a count
+// read before the overflow only if the count is high
+static uint64_t cyclesRead(void)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t t = TCNT1;
+  uint32_t overflows = cycles_overflows;
+  uint16_t high = cycles_overflows_high;
+  if((CYCLES_TIFR & _BV(TOV1)) && t < 0x8000)
+  {
+    if(++overflows == 0)
+      high++;
+  }
+  SREG = oldSREG;
+
+  return ((uint64_t)high << 48) | ((uint64_t)overflows << 16) | t;
+}
+
+/* Returns the low 32 bits of the tick count. The difference of two
+ * timestamps is right for intervals up to 2^32 ticks, which is 268 seconds
+ * at 16 MHz without prescaler.
+ */
+uint32_t cycleTicks(void)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t t = TCNT1;
+  uint16_t overflows = cycles_overflows;
+  if((CYCLES_TIFR & _BV(TOV1)) && t < 0x8000)
+    overflows++;
+  SREG = oldSREG;
+
+  return ((uint32_t)overflows << 16) | t;
+}
+
+// Returns the number of clock cycles since cyclesBegin()
+uint64_t cycles64(void)
+{
+  return cyclesRead() << cycles_shift;
+}
+
+// Returns the number of microseconds since cyclesBegin(). Splitting the
+// division keeps the products within 64 bits, and is exact for clocks that
+// aren't a whole number of MHz too
+uint64_t micros64(void)
+{
+  uint64_t cycles = cycles64();
+#if F_CPU % 1000000UL == 0
+  return cycles / (F_CPU / 1000000UL);
+#else
+  return (cycles / F_CPU) * 1000000UL + ((cycles % F_CPU) * 1000000UL) / F_CPU;
+#endif
+}
+
+#endif
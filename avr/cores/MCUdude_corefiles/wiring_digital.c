@@ -58,6 +58,65 @@ void pinMode(uint8_t pin, uint8_t mode)
   }
 }
 
+// Read by timerPwmActive() in wiring_private.h
+const timer_com_t PROGMEM timer_to_com_PGM[TIMER5C + 1] =
+{
+#if defined(TCCR0) && defined(COM01)
+  [TIMER0]  = { (uint16_t) &TCCR0, _BV(COM01) },
+  [TIMER0A] = { (uint16_t) &TCCR0, _BV(COM01) },
+#endif
+#if defined(TCCR0A) && defined(COM0A1)
+  [TIMER0A] = { (uint16_t) &TCCR0A, _BV(COM0A1) },
+#endif
+#if defined(TCCR0A) && defined(COM0B1)
+  [TIMER0B] = { (uint16_t) &TCCR0A, _BV(COM0B1) },
+#endif
+#if defined(TCCR1A) && defined(COM1A1)
+  [TIMER1A] = { (uint16_t) &TCCR1A, _BV(COM1A1) },
+#endif
+#if defined(TCCR1A) && defined(COM1B1)
+  [TIMER1B] = { (uint16_t) &TCCR1A, _BV(COM1B1) },
+#endif
+#if defined(TCCR1A) && defined(COM1C1)
+  [TIMER1C] = { (uint16_t) &TCCR1A, _BV(COM1C1) },
+#endif
+#if defined(TCCR2) && defined(COM21)
+  [TIMER2]  = { (uint16_t) &TCCR2, _BV(COM21) },
+#endif
+#if defined(TCCR2A) && defined(COM2A1)
+  [TIMER2A] = { (uint16_t) &TCCR2A, _BV(COM2A1) },
+#endif
+#if defined(TCCR2A) && defined(COM2B1)
+  [TIMER2B] = { (uint16_t) &TCCR2A, _BV(COM2B1) },
+#endif
+#if defined(TCCR3A) && defined(COM3A1)
+  [TIMER3A] = { (uint16_t) &TCCR3A, _BV(COM3A1) },
+#endif
+#if defined(TCCR3A) && defined(COM3B1)
+  [TIMER3B] = { (uint16_t) &TCCR3A, _BV(COM3B1) },
+#endif
+#if defined(TCCR3A) && defined(COM3C1)
+  [TIMER3C] = { (uint16_t) &TCCR3A, _BV(COM3C1) },
+#endif
+#if defined(TCCR4A) && defined(COM4A1)
+  [TIMER4A] = { (uint16_t) &TCCR4A, _BV(COM4A1) },
+#endif
+#if defined(TCCR4A) && defined(COM4B1)
+  [TIMER4B] = { (uint16_t) &TCCR4A, _BV(COM4B1) },
+#endif
+#if defined(TCCR4A) && defined(COM4C1)
+  [TIMER4C] = { (uint16_t) &TCCR4A, _BV(COM4C1) },
+#endif
+#if defined(TCCR4C) && defined(COM4D1)
+  [TIMER4D] = { (uint16_t) &TCCR4C, _BV(COM4D1) },
+#endif
+#if defined(TCCR5A)
+  [TIMER5A] = { (uint16_t) &TCCR5A, _BV(COM5A1) },
+  [TIMER5B] = { (uint16_t) &TCCR5A, _BV(COM5B1) },
+  [TIMER5C] = { (uint16_t) &TCCR5A, _BV(COM5C1) },
+#endif
+};
+
 // Forcing this inline keeps the callers from having to push their own stuff
 // on the stack. It is a good performance win and only takes 1 more byte per
 // user than calling. (It will take more bytes on the 168.)
@@ -72,7 +131,9 @@ void pinMode(uint8_t pin, uint8_t mode)
 //
 //static inline void turnOffPWM(uint8_t timer) __attribute__ ((always_inline));
 //static inline void turnOffPWM(uint8_t timer)
-static void turnOffPWM(uint8_t timer)
+//
+// Not static, as the cached pin handles in wiring_fast.cpp use it too
+void turnOffPWM(uint8_t timer)
 {
   switch (timer)
   {
@@ -101,12 +162,12 @@ static void turnOffPWM(uint8_t timer)
     #endif
     #if defined(TCCR2A) && defined(COM2A1)
       case TIMER2A:
-        TCCR2A &= ~_BV(COM2A1);
+        timer2Write(TCCR2A, TCR2AUB, TCCR2A & ~_BV(COM2A1));
         break;
     #endif
     #if defined(TCCR2A) && defined(COM2B1)
       case TIMER2B:
-        TCCR2A &= ~_BV(COM2B1);
+        timer2Write(TCCR2A, TCR2AUB, TCCR2A & ~_BV(COM2B1));
         break;
     #endif
 
@@ -193,9 +254,9 @@ void digitalWrite(uint8_t pin, uint8_t val)
 
   if (port == NOT_A_PIN) return;
 
-  // If the pin that support PWM output, we need to turn it off
+  // If the pin is driven by a PWM output, we need to turn it off
   // before doing a digital write.
-  if (timer != NOT_ON_TIMER) turnOffPWM(timer);
+  if (timerPwmActive(timer)) turnOffPWM(timer);
 
   out = portOutputRegister(port);
 
@@ -219,10 +280,37 @@ int digitalRead(uint8_t pin)
 
   if (port == NOT_A_PIN) return LOW;
 
-  // If the pin that support PWM output, we need to turn it off
+  // If the pin is driven by a PWM output, we need to turn it off
   // before getting a digital reading.
-  if (timer != NOT_ON_TIMER) turnOffPWM(timer);
+  if (timerPwmActive(timer)) turnOffPWM(timer);
 
   if (*portInputRegister(port) & bit) return HIGH;
   return LOW;
 }
+
+void digitalToggle(uint8_t pin)
+{
+  uint8_t timer = digitalPinToTimer(pin);
+  uint8_t bit = digitalPinToBitMask(pin);
+  uint8_t port = digitalPinToPort(pin);
+
+  if (port == NOT_A_PIN) return;
+
+  // If the pin is driven by a PWM output, we need to turn it off
+  // before toggling it.
+  if (timerPwmActive(timer)) turnOffPWM(timer);
+
+#if defined(PINX_TOGGLE)
+  // Writing a one to the PINx register only toggles the bits that are set,
+  // so the other pins on the port are never touched and there is no need
+  // to disable interrupts.
+  *portInputRegister(port) = bit;
+#else
+  volatile uint8_t *out = portOutputRegister(port);
+
+  uint8_t oldSREG = SREG;
+  cli();
+  *out ^= bit;
+  SREG = oldSREG;
+#endif
+}
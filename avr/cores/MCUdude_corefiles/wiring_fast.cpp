@@ -0,0 +1,176 @@
+/* wiring_fast.cpp
+|| Fast digital I/O for pins selected at run time (PinHandle, PinBus)
+||
+|| See wiring_fast.h
+*/
+
+#include "wiring_private.h"
+#include "wiring_fast.h"
+
+// Dummy register that invalid pin handles read from and write to
+static volatile uint8_t no_pin_reg;
+
+PinHandle::PinHandle(uint8_t pin)
+{
+  uint8_t port = digitalPinToPort(pin);
+
+  if(port == NOT_A_PIN)
+  {
+    _out = _in = _ddr = &no_pin_reg;
+    _mask = 0;
+    _timer = NOT_ON_TIMER;
+    return;
+  }
+
+  _out = portOutputRegister(port);
+  _in = portInputRegister(port);
+  _ddr = portModeRegister(port);
+  _mask = digitalPinToBitMask(pin);
+  _timer = digitalPinToTimer(pin);
+
+  // Disconnect PWM once, so write() doesn't have to check for it
+  if(timerPwmActive(_timer))
+    turnOffPWM(_timer);
+}
+
+PinBus::PinBus(const uint8_t *pins, uint8_t count)
+{
+  _numGroups = 0;
+  if(count > PINBUS_MAX_PINS)
+    count = PINBUS_MAX_PINS;
+  _width = count;
+
+  for(uint8_t i = 0; i < count; i++)
+  {
+    _map[i] = NO_PIN;
+
+    uint8_t port = digitalPinToPort(pins[i]);
+    if(port == NOT_A_PIN)
+      continue;
+
+    uint8_t timer = digitalPinToTimer(pins[i]);
+    if(timerPwmActive(timer))
+      turnOffPWM(timer);
+
+    uint8_t mask = digitalPinToBitMask(pins[i]);
+    uint8_t bit = 0;
+    while(!(mask & _BV(bit)))
+      bit++;
+
+    // Find the group of this port, or start a new one
+    uint8_t g = 0;
+    while(g < _numGroups && _groups[g].port != port)
+      g++;
+    if(g == _numGroups)
+    {
+      if(_numGroups == PINBUS_MAX_PORTS)
+        continue;
+      _numGroups++;
+      _groups[g].out = portOutputRegister(port);
+      _groups[g].in = portInputRegister(port);
+      _groups[g].port = port;
+      _groups[g].mask = 0;
+      _groups[g].shift = bit - i;
+    }
+    else if(_groups[g].shift != (int8_t)(bit - i))
+      _groups[g].shift = SCATTER;
+
+    _groups[g].mask |= mask;
+    _map[i] = (g << 3) | bit;
+  }
+}
+
+void PinBus::mode(uint8_t m)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  for(uint8_t g = 0; g < _numGroups; g++)
+  {
+    volatile uint8_t *ddr = portModeRegister(_groups[g].port);
+    uint8_t mask = _groups[g].mask;
+    if(m == OUTPUT)
+      *ddr |= mask;
+    else
+    {
+      *ddr &= ~mask;
+      if(m == INPUT_PULLUP)
+        *_groups[g].out |= mask;
+      else
+        *_groups[g].out &= ~mask;
+    }
+  }
+  SREG = oldSREG;
+}
+
+void PinBus::write(uint16_t value)
+{
+  uint8_t bits[PINBUS_MAX_PORTS];
+  bool scatter = false;
+
+  // Compute the port values before disabling interrupts
+  for(uint8_t g = 0; g < _numGroups; g++)
+  {
+    int8_t shift = _groups[g].shift;
+    if(shift == SCATTER)
+    {
+      bits[g] = 0;
+      scatter = true;
+    }
+    else if(shift >= 0)
+      bits[g] = value << shift;
+    else
+      bits[g] = value >> -shift;
+  }
+
+  if(scatter)
+  {
+    uint16_t valueBit = 1;
+    for(uint8_t i = 0; i < _width; i++, valueBit <<= 1)
+    {
+      uint8_t map = _map[i];
+      if(map != NO_PIN && (value & valueBit) && _groups[map >> 3].shift == SCATTER)
+        bits[map >> 3] |= _BV(map & 0x07);
+    }
+  }
+
+  uint8_t oldSREG = SREG;
+  cli();
+  for(uint8_t g = 0; g < _numGroups; g++)
+  {
+    uint8_t mask = _groups[g].mask;
+    *_groups[g].out = (*_groups[g].out & ~mask) | (bits[g] & mask);
+  }
+  SREG = oldSREG;
+}
+
+uint16_t PinBus::read() const
+{
+  uint8_t bits[PINBUS_MAX_PORTS];
+  uint16_t value = 0;
+  bool scatter = false;
+
+  for(uint8_t g = 0; g < _numGroups; g++)
+  {
+    bits[g] = *_groups[g].in & _groups[g].mask;
+    int8_t shift = _groups[g].shift;
+    if(shift == SCATTER)
+      scatter = true;
+    else if(shift >= 0)
+      value |= bits[g] >> shift;
+    else
+      value |= (uint16_t)bits[g] << -shift;
+  }
+
+  if(scatter)
+  {
+    uint16_t valueBit = 1;
+    for(uint8_t i = 0; i < _width; i++, valueBit <<= 1)
+    {
+      uint8_t map = _map[i];
+      if(map != NO_PIN && _groups[map >> 3].shift == SCATTER && (bits[map >> 3] & _BV(map & 0x07)))
+        value |= valueBit;
+    }
+  }
+
+  return value;
+}
@@ -0,0 +1,403 @@
+/* wiring_fast.h
+|| Fast digital I/O for pins that are known at compile time
+||
+|| digitalWrite() and friends look up the port, bit mask and timer of a pin
+|| in PROGMEM tables on every call. When the pin number is a constant, these
+|| functions resolve the port and bit at compile time instead, and compile
+|| down to a single SBI/CBI/SBIS/SBIC instruction on ports that are within
+|| reach of these instructions. When the pin number is not a constant, the
+|| regular digitalWrite(), digitalRead() and pinMode() functions are used.
+||
+|| For pins that are selected at runtime, PinHandle caches the lookups once
+|| so that every later access only costs a pointer dereference.
+||
+|| PinBus and FastPinBus treat an arbitrary list of pins as one parallel
+|| bus, e.g. the data lines of an 8080-style LCD or an R-2R DAC. The pins
+|| are grouped by port, and a value is written with one masked write per port.
+||
+|| Note that the fast path does not disconnect a PWM output from the pin.
+|| Call digitalWrite() once after analogWrite() before using it.
+*/
+
+#ifndef WIRING_FAST_H
+#define WIRING_FAST_H
+
+#include "Arduino.h"
+#include "pins_arduino.h"
+
+// Only use the fast path if the variant provides a compile-time pin mapping
+#if defined(digitalPinToPortReg) && defined(digitalPinToDDRReg) \
+&& defined(digitalPinToPINReg) && defined(digitalPinToBit)
+  #define FAST_DIGITAL_IO
+#endif
+
+// Registers in the lower 32 bytes of the I/O space can be accessed by
+// SBI/CBI, which makes a single bit read-modify-write atomic
+#define fastRegInSbiRange(reg) ((uintptr_t)(reg) < 0x20 + __SFR_OFFSET)
+
+
+/*************************************************************
+ * Function style API
+ *************************************************************/
+
+static inline void fastDigitalWrite(uint8_t, uint8_t) __attribute__((always_inline, unused));
+static inline void fastDigitalWrite(uint8_t pin, uint8_t val)
+{
+#if defined(FAST_DIGITAL_IO)
+  if(__builtin_constant_p(pin) && pin < NUM_DIGITAL_PINS)
+  {
+    volatile uint8_t *out = digitalPinToPortReg(pin);
+    const uint8_t bit = _BV(digitalPinToBit(pin));
+
+    if(fastRegInSbiRange(out))
+    {
+      if(val == LOW)
+        *out &= ~bit;
+      else
+        *out |= bit;
+    }
+    else
+    {
+      uint8_t oldSREG = SREG;
+      cli();
+      if(val == LOW)
+        *out &= ~bit;
+      else
+        *out |= bit;
+      SREG = oldSREG;
+    }
+  }
+  else
+#endif
+    digitalWrite(pin, val);
+}
+
+static inline void fastDigitalToggle(uint8_t) __attribute__((always_inline, unused));
+static inline void fastDigitalToggle(uint8_t pin)
+{
+#if defined(FAST_DIGITAL_IO)
+  if(__builtin_constant_p(pin) && pin < NUM_DIGITAL_PINS)
+  {
+    const uint8_t bit = _BV(digitalPinToBit(pin));
+  #if defined(PINX_TOGGLE)
+    // A plain store rather than SBI, since reading PINx back would toggle
+    // every other high input on the port if the compiler doesn't emit SBI
+    *digitalPinToPINReg(pin) = bit;
+  #else
+    volatile uint8_t *out = digitalPinToPortReg(pin);
+    uint8_t oldSREG = SREG;
+    cli();
+    *out ^= bit;
+    SREG = oldSREG;
+  #endif
+  }
+  else
+#endif
+    digitalToggle(pin);
+}
+
+static inline int fastDigitalRead(uint8_t) __attribute__((always_inline, unused));
+static inline int fastDigitalRead(uint8_t pin)
+{
+#if defined(FAST_DIGITAL_IO)
+  if(__builtin_constant_p(pin) && pin < NUM_DIGITAL_PINS)
+    return (*digitalPinToPINReg(pin) & _BV(digitalPinToBit(pin))) ? HIGH : LOW;
+  else
+#endif
+    return digitalRead(pin);
+}
+
+static inline void fastPinMode(uint8_t, uint8_t) __attribute__((always_inline, unused));
+static inline void fastPinMode(uint8_t pin, uint8_t mode)
+{
+#if defined(FAST_DIGITAL_IO)
+  if(__builtin_constant_p(pin) && __builtin_constant_p(mode) && pin < NUM_DIGITAL_PINS
+  && fastRegInSbiRange(digitalPinToDDRReg(pin)))
+  {
+    volatile uint8_t *ddr = digitalPinToDDRReg(pin);
+    volatile uint8_t *out = digitalPinToPortReg(pin);
+    const uint8_t bit = _BV(digitalPinToBit(pin));
+
+    if(mode == OUTPUT)
+      *ddr |= bit;
+    else if(mode == INPUT_PULLUP)
+    {
+      *ddr &= ~bit;
+      *out |= bit;
+    }
+    else // INPUT
+    {
+      *ddr &= ~bit;
+      *out &= ~bit;
+    }
+  }
+  else
+#endif
+    pinMode(pin, mode);
+}
+
+
+/*************************************************************
+ * Template style API
+ *************************************************************/
+
+template<uint8_t pin>
+class FastPin
+{
+  static_assert(pin < NUM_DIGITAL_PINS, "FastPin: not a valid digital pin");
+
+  public:
+    static inline void mode(uint8_t m) __attribute__((always_inline)) { fastPinMode(pin, m); }
+    static inline void write(uint8_t val) __attribute__((always_inline)) { fastDigitalWrite(pin, val); }
+    static inline void high() __attribute__((always_inline)) { fastDigitalWrite(pin, HIGH); }
+    static inline void low() __attribute__((always_inline)) { fastDigitalWrite(pin, LOW); }
+    static inline void toggle() __attribute__((always_inline)) { fastDigitalToggle(pin); }
+    static inline int read() __attribute__((always_inline)) { return fastDigitalRead(pin); }
+};
+
+
+/*************************************************************
+ * Cached pin handle for pins selected at runtime
+ *************************************************************/
+
+// Looks up the registers, bit mask and timer of a pin once, when the handle
+// is created. Any PWM output on the pin is disconnected at the same time, so
+// the methods below skip both the table lookups and the turnOffPWM() check.
+// An invalid pin number results in a handle that does nothing.
+class PinHandle
+{
+  public:
+    PinHandle(uint8_t pin);
+
+    inline void mode(uint8_t m) __attribute__((always_inline))
+    {
+      uint8_t oldSREG = SREG;
+      cli();
+      if(m == OUTPUT)
+        *_ddr |= _mask;
+      else
+      {
+        *_ddr &= ~_mask;
+        if(m == INPUT_PULLUP)
+          *_out |= _mask;
+        else
+          *_out &= ~_mask;
+      }
+      SREG = oldSREG;
+    }
+
+    inline void write(uint8_t val) __attribute__((always_inline))
+    {
+      uint8_t oldSREG = SREG;
+      cli();
+      if(val == LOW)
+        *_out &= ~_mask;
+      else
+        *_out |= _mask;
+      SREG = oldSREG;
+    }
+
+    inline void high() __attribute__((always_inline)) { write(HIGH); }
+    inline void low() __attribute__((always_inline)) { write(LOW); }
+
+    inline void toggle() __attribute__((always_inline))
+    {
+    #if defined(PINX_TOGGLE)
+      *_in = _mask;
+    #else
+      uint8_t oldSREG = SREG;
+      cli();
+      *_out ^= _mask;
+      SREG = oldSREG;
+    #endif
+    }
+
+    inline int read() const __attribute__((always_inline))
+    {
+      return (*_in & _mask) ? HIGH : LOW;
+    }
+
+    inline uint8_t bitMask() const { return _mask; }
+    inline uint8_t timer() const { return _timer; }
+
+  private:
+    volatile uint8_t *_out;
+    volatile uint8_t *_in;
+    volatile uint8_t *_ddr;
+    uint8_t _mask;
+    uint8_t _timer;
+};
+
+
+/*************************************************************
+ * Parallel bus of arbitrary pins
+ *************************************************************/
+
+#define PINBUS_MAX_PINS  16
+#define PINBUS_MAX_PORTS 4
+
+// Bit n of the bus value maps to pins[n]. The pins are grouped by port when
+// the bus is created. If the pins of a port are wired in the same order as
+// the value bits (e.g. bus bit 0-3 on PD4-PD7), the port value is computed
+// with a single shift, otherwise bit by bit. Invalid pins and pins on more
+// than PINBUS_MAX_PORTS different ports are ignored.
+class PinBus
+{
+  public:
+    PinBus(const uint8_t *pins, uint8_t count);
+
+    void mode(uint8_t m);
+    void write(uint16_t value);
+    uint16_t read() const;
+
+    inline uint8_t width() const { return _width; }
+
+  private:
+    enum { NO_PIN = 0xff, SCATTER = 0x7f };
+
+    struct Group
+    {
+      volatile uint8_t *out;
+      volatile uint8_t *in;
+      uint8_t port;
+      uint8_t mask;
+      int8_t shift; // Port bit minus bus bit, or SCATTER if it differs between pins
+    };
+
+    Group _groups[PINBUS_MAX_PORTS];
+    uint8_t _map[PINBUS_MAX_PINS]; // Group index << 3 | port bit, for every bus bit
+    uint8_t _numGroups;
+    uint8_t _width;
+};
+
+// Same as PinBus, but for pins that are known at compile time. All port
+// masks and bit positions are resolved by the compiler, so write() only
+// costs one read-modify-write per port, plus roughly two cycles per pin.
+//   FastPinBus<PIN_PD0, PIN_PD1, PIN_PD2, PIN_PD3, PIN_PB0, PIN_PB1> bus;
+#if defined(FAST_DIGITAL_IO)
+template<uint8_t... pins>
+class FastPinBus
+{
+  static_assert(sizeof...(pins) > 0 && sizeof...(pins) <= PINBUS_MAX_PINS, "FastPinBus: 1 to 16 pins");
+  static_assert(((pins < NUM_DIGITAL_PINS) && ...), "FastPinBus: not a valid digital pin");
+
+  public:
+    static inline void mode(uint8_t m) __attribute__((always_inline))
+    {
+      uint8_t oldSREG = SREG;
+      cli();
+      #if defined(PORTB)
+        modePort(&DDRB, &PORTB, m);
+      #endif
+      #if defined(PORTC)
+        modePort(&DDRC, &PORTC, m);
+      #endif
+      #if defined(PORTD)
+        modePort(&DDRD, &PORTD, m);
+      #endif
+      #if defined(PORTE)
+        modePort(&DDRE, &PORTE, m);
+      #endif
+      SREG = oldSREG;
+    }
+
+    static inline void write(uint16_t value) __attribute__((always_inline))
+    {
+      uint8_t oldSREG = SREG;
+      cli();
+      #if defined(PORTB)
+        writePort(&PORTB, value);
+      #endif
+      #if defined(PORTC)
+        writePort(&PORTC, value);
+      #endif
+      #if defined(PORTD)
+        writePort(&PORTD, value);
+      #endif
+      #if defined(PORTE)
+        writePort(&PORTE, value);
+      #endif
+      SREG = oldSREG;
+    }
+
+    static inline uint16_t read() __attribute__((always_inline))
+    {
+      uint16_t value = 0;
+      #if defined(PORTB)
+        if(portMask(&PORTB))
+          value |= gather<0, pins...>(&PORTB, PINB);
+      #endif
+      #if defined(PORTC)
+        if(portMask(&PORTC))
+          value |= gather<0, pins...>(&PORTC, PINC);
+      #endif
+      #if defined(PORTD)
+        if(portMask(&PORTD))
+          value |= gather<0, pins...>(&PORTD, PIND);
+      #endif
+      #if defined(PORTE)
+        if(portMask(&PORTE))
+          value |= gather<0, pins...>(&PORTE, PINE);
+      #endif
+      return value;
+    }
+
+    static constexpr uint8_t width() { return sizeof...(pins); }
+
+  private:
+    // Bit mask of the bus pins that are on this port
+    static inline uint8_t portMask(volatile uint8_t *port) __attribute__((always_inline))
+    {
+      return ((digitalPinToPortReg(pins) == port ? _BV(digitalPinToBit(pins)) : 0) | ... | 0);
+    }
+
+    // Port bits for the bus bits from index and up
+    template<uint8_t index, uint8_t pin, uint8_t... rest>
+    __attribute__((always_inline)) static inline uint8_t scatter(volatile uint8_t *port, uint16_t value)
+    {
+      uint8_t bits = (digitalPinToPortReg(pin) == port && (value & (1U << index))) ? _BV(digitalPinToBit(pin)) : 0;
+      if constexpr(sizeof...(rest) > 0)
+        bits |= scatter<index + 1, rest...>(port, value);
+      return bits;
+    }
+
+    // Bus bits from index and up for the input value of a port
+    template<uint8_t index, uint8_t pin, uint8_t... rest>
+    __attribute__((always_inline)) static inline uint16_t gather(volatile uint8_t *port, uint8_t portValue)
+    {
+      uint16_t value = (digitalPinToPortReg(pin) == port && (portValue & _BV(digitalPinToBit(pin)))) ? (1U << index) : 0;
+      if constexpr(sizeof...(rest) > 0)
+        value |= gather<index + 1, rest...>(port, portValue);
+      return value;
+    }
+
+    static inline void writePort(volatile uint8_t *out, uint16_t value) __attribute__((always_inline))
+    {
+      const uint8_t mask = portMask(out);
+      if(mask == 0xff)
+        *out = scatter<0, pins...>(out, value);
+      else if(mask)
+        *out = (*out & ~mask) | scatter<0, pins...>(out, value);
+    }
+
+    static inline void modePort(volatile uint8_t *ddr, volatile uint8_t *out, uint8_t m) __attribute__((always_inline))
+    {
+      const uint8_t mask = portMask(out);
+      if(!mask)
+        return;
+      if(m == OUTPUT)
+        *ddr |= mask;
+      else
+      {
+        *ddr &= ~mask;
+        if(m == INPUT_PULLUP)
+          *out |= mask;
+        else
+          *out &= ~mask;
+      }
+    }
+};
+#endif
+
+
+#endif // WIRING_FAST_H
@@ -41,10 +41,72 @@ extern "C"{
 #define sbi(sfr, bit) (_SFR_BYTE(sfr) |= _BV(bit))
 #endif
 
+void turnOffPWM(uint8_t timer);
+
+// Compare register value for an analogWrite() value, in the range set by
+// analogWriteResolution() and scaled to the timer top value set by pwmSetup()
+uint16_t analogWriteToDuty(uint8_t timer, uint16_t value);
+
+// Control register and COMnx1 bit of each timer channel (TIMER0 to TIMER5C),
+// the bit turnOffPWM() clears. NOT_ON_TIMER and missing channels have no bit
+typedef struct
+{
+  uint16_t tccr;
+  uint8_t com;
+} timer_com_t;
+extern const timer_com_t PROGMEM timer_to_com_PGM[];
+
+// Returns true if the PWM output of the timer channel is connected to the
+// pin, so digitalWrite() and digitalRead() only call turnOffPWM() when there
+// is something to disconnect. The COM bits are read from the timer itself,
+// so it doesn't matter what connected the output
+static inline uint8_t timerPwmActive(uint8_t timer)
+{
+  uint8_t com = pgm_read_byte(&timer_to_com_PGM[timer].com);
+  return com && (*(volatile uint8_t *)pgm_read_word(&timer_to_com_PGM[timer].tccr) & com);
+}
+
+// Writes a Timer2 register. When millis() runs on Timer2 clocked from a
+// 32.768 kHz crystal, a write takes a few crystal cycles to reach the timer,
+// and writing again before the update busy flag ub in ASSR is cleared can
+// corrupt the register. Every write then waits for the flag first
+#if defined(MILLIS_TIMER2_ASYNC) && defined(ASSR)
+  #define timer2Write(reg, ub, value) do { while(ASSR & _BV(ub)); (reg) = (value); } while(0)
+#else
+  #define timer2Write(reg, ub, value) do { (reg) = (value); } while(0)
+#endif
+
 uint32_t countPulseASM(volatile uint8_t *port, uint8_t bit, uint8_t stateMask, unsigned long maxloops);
 
 typedef void (*voidFuncPtr)(void);
 
+extern uint8_t analog_reference;
+extern uint8_t analog_adlar;
+
+// ADMUX value that selects the analog reference, the result alignment and an ADC channel
+#define analogChannelToMux(ch) ((analog_reference << 6) | analog_adlar | ((ch) & 0x07))
+
+// Conversion result. In 8-bit mode the result is left adjusted, and ADCH holds it all
+#define analogConversionResult() (analog_adlar ? ADCH : ADC)
+
+// Called from the ADC conversion complete interrupt in wiring_adc.c. Only
+// referencing this pulls in the interrupt, so sketches that don't use it
+// are free to define their own ADC_vect
+extern volatile voidFuncPtr adc_handler;
+
+// Called from the Timer1 overflow interrupt in wiring_timer1_ovf.c, the
+// same way as adc_handler
+extern volatile voidFuncPtr timer1_ovf_handler;
+
+// One bit for each core function that has reconfigured Timer1 for its own
+// use. analogWriteResolution() and pwmSetup() leave Timer1 alone while any
+// is set. Only changed with interrupts disabled
+extern volatile uint8_t timer1_busy;
+#define TIMER1_BUSY_TONE    0x01
+#define TIMER1_BUSY_CAPTURE 0x02
+#define TIMER1_BUSY_CYCLES  0x04
+#define TIMER1_BUSY_SOFTPWM 0x08
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
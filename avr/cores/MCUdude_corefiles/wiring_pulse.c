@@ -62,6 +62,11 @@ unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout)
  */
 unsigned long pulseInLong(uint8_t pin, uint8_t state, unsigned long timeout)
 {
+#if defined(MILLIS_NONE)
+  // Without micros() the timeout would never expire, so count loop
+  // iterations like pulseIn() does
+  return pulseIn(pin, state, timeout);
+#else
   // cache the port and bit of the pin in order to speed up the
   // pulse width measuring loop and achieve finer resolution.  calling
   // digitalRead() instead yields much coarser resolution.
@@ -90,4 +95,5 @@ unsigned long pulseInLong(uint8_t pin, uint8_t state, unsigned long timeout)
       return 0;
   }
   return micros() - start;
+#endif
 }
@@ -0,0 +1,485 @@
+/* wiring_pwm_batch.c
+|| Synchronized PWM updates on several channels
+||
+|| In PWM mode the compare registers are double buffered, and the new
+|| values are copied from the buffers when the timer reaches TOP or BOTTOM.
+|| If that update lands between two analogWrite() calls, one PWM period
+|| gets the new duty cycle on one channel and the old one on the other.
+||
+|| pwmStage() only stores the new value. pwmCommit() looks up the registers
+|| first, waits with interrupts enabled until the timer isn't within the
+|| last few ticks before the update, and then writes all staged values of a
+|| timer with interrupts disabled, so they're always copied in the same
+|| update. Interrupts are only disabled for the writes themselves.
+||
+|| A 16-bit timer with a top value so small that the writes don't fit in a
+|| period minus the guard ticks is committed from its overflow interrupt
+|| instead. Timer1 shares its overflow interrupt with the input capture and
+|| cycle counter code, which run Timer1 in normal mode and never get here.
+*/
+
+#include "wiring_private.h"
+#include "pins_arduino.h"
+
+// Clock cycles it takes at most from reading the timer count to the last
+// register write, for the check and the control register write, and for
+// each compare register
+#define PWM_COMMIT_CYCLES_BASE    24
+#define PWM_COMMIT_CYCLES_CHANNEL 16
+
+#define PWM_CHANNEL_BIT(t) (1U << (t))
+
+static uint16_t pwm_staged[TIMER4B + 1];
+static uint16_t pwm_dirty; // One bit per timer channel with a staged value
+
+#if !defined(MILLIS_NONE)
+static unsigned long pwm_commit_micros;
+static unsigned long pwm_commit_wait;
+#endif
+
+// The register writes of one timer, looked up before interrupts are disabled
+typedef struct
+{
+  volatile uint8_t *tccr;
+  uint8_t com;               // COMnx1 bits to set in tccr
+  uint8_t wide;              // 16-bit compare registers
+  uint8_t count;
+  volatile uint8_t *ocr[2];
+  uint16_t duty[2];
+} pwm_commit_t;
+
+#if defined(TIMER4_OVF_vect) && defined(TCCR4A) && defined(ICR4) && defined(WGM43)
+  #define PWM_OVERFLOW_TIMERS 4
+#elif defined(TIMER3_OVF_vect) && defined(TCCR3A) && defined(ICR3)
+  #define PWM_OVERFLOW_TIMERS 3
+#elif defined(TIMER1_OVF_vect) && defined(TCCR1A) && defined(ICR1) && defined(WGM13)
+  #define PWM_OVERFLOW_TIMERS 1
+#endif
+
+#if defined(PWM_OVERFLOW_TIMERS)
+// Commits waiting for the overflow interrupt of Timer1, 3 or 4, at n - 1
+static pwm_commit_t pwm_overflow_commit[PWM_OVERFLOW_TIMERS];
+static volatile uint8_t pwm_overflow_pending; // One bit per timer
+#endif
+
+static const uint16_t pwm_timer_channels[] =
+{
+  PWM_CHANNEL_BIT(TIMER0A) | PWM_CHANNEL_BIT(TIMER0B),
+  PWM_CHANNEL_BIT(TIMER1A) | PWM_CHANNEL_BIT(TIMER1B),
+  PWM_CHANNEL_BIT(TIMER2)  | PWM_CHANNEL_BIT(TIMER2A) | PWM_CHANNEL_BIT(TIMER2B),
+  PWM_CHANNEL_BIT(TIMER3A) | PWM_CHANNEL_BIT(TIMER3B),
+  PWM_CHANNEL_BIT(TIMER4A) | PWM_CHANNEL_BIT(TIMER4B)
+};
+static const uint8_t pwm_timer_first_channel[] = {TIMER0A, TIMER1A, TIMER2, TIMER3A, TIMER4A};
+
+// Clock select value to prescaler. External clock sources count as 1
+static const uint16_t pwm_prescalers[] = {0, 1, 8, 64, 256, 1024, 1, 1};
+#if defined(CS22)
+static const uint16_t pwm_timer2_prescalers[] = {0, 1, 8, 32, 64, 128, 256, 1024};
+#endif
+
+#if defined(TCCR1A) && defined(ICR1) && defined(WGM13)
+// Top value of a 16-bit timer in PWM mode. The ICRn topped modes have WGMn3
+// set, and the 8, 9 and 10-bit modes are selected by WGMn1:0
+static uint16_t pwmTimer16Top(uint8_t tccra, uint8_t tccrb, uint16_t icr)
+{
+  if(tccrb & _BV(WGM13))
+    return icr;
+  return (tccra & 0x03) ? (0x80 << (tccra & 0x03)) - 1 : 0xffff;
+}
+#endif
+
+static uint8_t pwmTimerState(uint8_t n, uint16_t *top, uint16_t *prescaler)
+{
+  switch(n)
+  {
+    #if defined(TCCR0A) && defined(TCCR0B)
+    case 0:
+      *top = 0xff;
+      *prescaler = pwm_prescalers[TCCR0B & 0x07];
+      return 1;
+    #endif
+
+    #if defined(TCCR1A) && defined(ICR1) && defined(WGM13)
+    case 1:
+      *top = pwmTimer16Top(TCCR1A, TCCR1B, ICR1);
+      *prescaler = pwm_prescalers[TCCR1B & 0x07];
+      return 1;
+    #endif
+
+    #if defined(TCCR2A) && defined(TCCR2B)
+    case 2:
+      *top = 0xff;
+      *prescaler = pwm_timer2_prescalers[TCCR2B & 0x07];
+      return 1;
+    #elif defined(TCCR2) && defined(CS22)
+    case 2:
+      *top = 0xff;
+      *prescaler = pwm_timer2_prescalers[TCCR2 & 0x07];
+      return 1;
+    #endif
+
+    #if defined(TCCR3A) && defined(ICR3)
+    case 3:
+      *top = pwmTimer16Top(TCCR3A, TCCR3B, ICR3);
+      *prescaler = pwm_prescalers[TCCR3B & 0x07];
+      return 1;
+    #endif
+
+    #if defined(TCCR4A) && defined(ICR4) && defined(WGM43)
+    case 4:
+      *top = pwmTimer16Top(TCCR4A, TCCR4B, ICR4);
+      *prescaler = pwm_prescalers[TCCR4B & 0x07];
+      return 1;
+    #endif
+  }
+
+  return 0;
+}
+
+static uint16_t pwmTimerCount(uint8_t n)
+{
+  switch(n)
+  {
+    #if defined(TCNT0)
+    case 0: return TCNT0;
+    #endif
+    #if defined(TCNT1)
+    case 1: return TCNT1;
+    #endif
+    #if defined(TCNT2)
+    case 2: return TCNT2;
+    #endif
+    #if defined(TCNT3)
+    case 3: return TCNT3;
+    #endif
+    #if defined(TCNT4)
+    case 4: return TCNT4;
+    #endif
+  }
+  return 0;
+}
+
+// Compare register of a channel
+static volatile uint8_t *pwmChannelOcr(uint8_t timer)
+{
+  switch(timer)
+  {
+    #if defined(OCR0A)
+    case TIMER0A: return &OCR0A;
+    #endif
+    #if defined(OCR0B)
+    case TIMER0B: return &OCR0B;
+    #endif
+    #if defined(OCR1A)
+    case TIMER1A: return (volatile uint8_t *)&OCR1A;
+    #endif
+    #if defined(OCR1B)
+    case TIMER1B: return (volatile uint8_t *)&OCR1B;
+    #endif
+    #if defined(OCR2)
+    case TIMER2: return &OCR2;
+    #endif
+    #if defined(OCR2A)
+    case TIMER2A: return &OCR2A;
+    #endif
+    #if defined(OCR2B)
+    case TIMER2B: return &OCR2B;
+    #endif
+    #if defined(OCR3A)
+    case TIMER3A: return (volatile uint8_t *)&OCR3A;
+    #endif
+    #if defined(OCR3B)
+    case TIMER3B: return (volatile uint8_t *)&OCR3B;
+    #endif
+    #if defined(OCR4A)
+    case TIMER4A: return (volatile uint8_t *)&OCR4A;
+    #endif
+    #if defined(OCR4B)
+    case TIMER4B: return (volatile uint8_t *)&OCR4B;
+    #endif
+  }
+  return 0;
+}
+
+// Takes the staged values of a timer, and looks up their registers
+static void pwmCommitPrepare(pwm_commit_t *c, uint8_t n, uint16_t channels)
+{
+  uint8_t timer = pwm_timer_first_channel[n];
+
+  c->tccr = (volatile uint8_t *)pgm_read_word(&timer_to_com_PGM[timer].tccr);
+  c->com = 0;
+  c->wide = n != 0 && n != 2;
+  c->count = 0;
+
+  for(channels >>= timer; channels; channels >>= 1, timer++)
+  {
+    volatile uint8_t *ocr = pwmChannelOcr(timer);
+    if(!(channels & 0x01) || !ocr || c->count == 2)
+      continue;
+
+    #if defined(__AVR_ATmega328PB__) // Fix 324PB/328PB silicon bug
+      if(timer == TIMER3B || timer == TIMER4B)
+        PORTD |= _BV(PD2);
+    #endif
+
+    c->com |= pgm_read_byte(&timer_to_com_PGM[timer].com);
+    c->ocr[c->count] = ocr;
+    c->duty[c->count] = pwm_staged[timer];
+    c->count++;
+  }
+}
+
+// Connects the outputs and writes the compare registers. In Timer2 async
+// mode the update busy flags are cleared by pwmCommit() beforehand
+static void pwmCommitWrite(const pwm_commit_t *c)
+{
+  *c->tccr |= c->com;
+  for(uint8_t i = 0; i < c->count; i++)
+  {
+    if(c->wide)
+      *(volatile uint16_t *)c->ocr[i] = c->duty[i];
+    else
+      *c->ocr[i] = c->duty[i];
+  }
+}
+
+/* Writes the registers once the count is below limit, so the last write is
+ * done before the update. The count is checked again with interrupts
+ * disabled, since an interrupt between the first check and cli() can take
+ * longer than the guard ticks.
+ */
+static void pwmCommitWindow(uint8_t n, const pwm_commit_t *c, uint16_t limit)
+{
+  for(;;)
+  {
+    while(pwmTimerCount(n) >= limit);
+
+    uint8_t oldSREG = SREG;
+    cli();
+    if(pwmTimerCount(n) < limit)
+    {
+      pwmCommitWrite(c);
+      SREG = oldSREG;
+      return;
+    }
+    SREG = oldSREG;
+  }
+}
+
+#if defined(PWM_OVERFLOW_TIMERS)
+// Called from the overflow interrupt of timer n. In fast PWM mode the
+// overflow flag is set at TOP, a tick before the update at BOTTOM, so the
+// update has to pass first. The writes then have the whole period
+static void pwmOverflowWrite(uint8_t n)
+{
+  uint16_t top, prescaler;
+  if(pwmTimerState(n, &top, &prescaler) && prescaler)
+    while(pwmTimerCount(n) == top);
+
+  pwmCommitWrite(&pwm_overflow_commit[n - 1]);
+  pwm_overflow_pending &= ~_BV(n);
+}
+
+#if defined(TIMER1_OVF_vect) && defined(TCCR1A) && defined(ICR1) && defined(WGM13)
+#if defined(TIMSK1)
+  #define PWM_TIMSK1 TIMSK1
+  #define PWM_TIFR1  TIFR1
+#else
+  #define PWM_TIMSK1 TIMSK
+  #define PWM_TIFR1  TIFR
+#endif
+
+static voidFuncPtr pwm_saved_ovf_handler;
+
+static void pwmOverflowHandler1(void)
+{
+  pwmOverflowWrite(1);
+  PWM_TIMSK1 &= ~_BV(TOIE1);
+  timer1_ovf_handler = pwm_saved_ovf_handler;
+}
+#endif
+
+#if PWM_OVERFLOW_TIMERS >= 3
+ISR(TIMER3_OVF_vect)
+{
+  pwmOverflowWrite(3);
+  TIMSK3 &= ~_BV(TOIE3);
+}
+#endif
+
+#if PWM_OVERFLOW_TIMERS >= 4
+ISR(TIMER4_OVF_vect)
+{
+  pwmOverflowWrite(4);
+  TIMSK4 &= ~_BV(TOIE4);
+}
+#endif
+
+// Hands the writes to the overflow interrupt of timer n. Returns 0 if the
+// timer has no overflow commit
+static uint8_t pwmCommitOverflow(uint8_t n, const pwm_commit_t *c)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  switch(n)
+  {
+    #if defined(TIMER1_OVF_vect) && defined(TCCR1A) && defined(ICR1) && defined(WGM13)
+    case 1:
+      if(!(pwm_overflow_pending & _BV(1)))
+      {
+        pwm_saved_ovf_handler = timer1_ovf_handler;
+        timer1_ovf_handler = pwmOverflowHandler1;
+        PWM_TIFR1 = _BV(TOV1);
+        PWM_TIMSK1 |= _BV(TOIE1);
+      }
+      break;
+    #endif
+
+    #if PWM_OVERFLOW_TIMERS >= 3
+    case 3:
+      TIFR3 = _BV(TOV3);
+      TIMSK3 |= _BV(TOIE3);
+      break;
+    #endif
+
+    #if PWM_OVERFLOW_TIMERS >= 4
+    case 4:
+      TIFR4 = _BV(TOV4);
+      TIMSK4 |= _BV(TOIE4);
+      break;
+    #endif
+
+    default:
+      SREG = oldSREG;
+      return 0;
+  }
+
+  // A commit that's still pending is replaced, the new values supersede it
+  pwm_overflow_commit[n - 1] = *c;
+  pwm_overflow_pending |= _BV(n);
+  SREG = oldSREG;
+  return 1;
+}
+#endif
+
+/* Stores a new analogWrite() value for a PWM pin, which is applied by the
+ * next pwmCommit(). Unlike analogWrite(), 0 and the maximum value keep the
+ * PWM output connected, so the pin is switched in sync with the others.
+ * In fast PWM mode, 0 still gives a spike of one timer tick each period.
+ */
+void pwmStage(uint8_t pin, int value)
+{
+  uint8_t timer = digitalPinToTimer(pin);
+  if(timer == NOT_ON_TIMER || timer > TIMER4B)
+    return;
+
+  pinMode(pin, OUTPUT);
+
+  uint8_t oldSREG = SREG;
+  cli();
+  pwm_staged[timer] = analogWriteToDuty(timer, (uint16_t)value);
+  pwm_dirty |= PWM_CHANNEL_BIT(timer);
+  SREG = oldSREG;
+}
+
+/* Writes all staged values. The channels of each timer are updated in the
+ * same PWM period.
+ */
+void pwmCommit(void)
+{
+  unsigned long wait = 0;
+
+  for(uint8_t n = 0; n < sizeof(pwm_timer_channels) / sizeof(pwm_timer_channels[0]); n++)
+  {
+    uint16_t channels = pwm_dirty & pwm_timer_channels[n];
+    uint16_t top, prescaler;
+    if(!channels || !pwmTimerState(n, &top, &prescaler))
+      continue;
+
+    pwm_commit_t c;
+    uint8_t oldSREG = SREG;
+    cli();
+    pwmCommitPrepare(&c, n, channels);
+    pwm_dirty &= ~channels;
+    SREG = oldSREG;
+
+    // A stopped timer doesn't update the compare registers at all
+    if(!prescaler)
+    {
+      oldSREG = SREG;
+      cli();
+      pwmCommitWrite(&c);
+      SREG = oldSREG;
+      continue;
+    }
+
+    // Timer ticks before the update that the writes could overlap with
+    uint16_t guard = (PWM_COMMIT_CYCLES_BASE + c.count * PWM_COMMIT_CYCLES_CHANNEL) / prescaler + 1;
+    unsigned long periods = 1;
+
+    #if defined(MILLIS_TIMER2_ASYNC) && defined(ASSR)
+    // The async registers take up to two timer clock cycles to be latched,
+    // and the next write has to wait for the previous one
+    if(n == 2)
+    {
+      guard += 2;
+      while(ASSR & (_BV(TCR2AUB) | _BV(OCR2AUB) | _BV(OCR2BUB)));
+    }
+    #endif
+
+    // The 8-bit timers always leave a window. A 16-bit timer with a small
+    // ICRn top is committed from its overflow interrupt
+    if(top > 2 * guard)
+      pwmCommitWindow(n, &c, top - guard);
+    #if defined(PWM_OVERFLOW_TIMERS)
+    else if(pwmCommitOverflow(n, &c))
+      periods = 2;
+    #endif
+    else
+      pwmCommitWindow(n, &c, top / 2);
+
+    // The new values are in use within one PWM period, which is at most
+    // 2 * (top + 1) timer ticks in phase correct mode. An overflow commit
+    // may only be written in the next period
+    unsigned long timerWait = (2UL * ((uint32_t)top + 1) * prescaler) / clockCyclesPerMicrosecond();
+    #if defined(MILLIS_TIMER2_ASYNC) && defined(ASSR)
+    // Timer2 counts the 32.768 kHz crystal, 2 * 256 ticks are 15625 us
+    if(n == 2)
+      timerWait = ((2UL * ((uint32_t)top + 1) * prescaler) >> 9) * 15625UL;
+    #endif
+    timerWait = timerWait * periods + 1;
+    if(timerWait > wait)
+      wait = timerWait;
+  }
+
+#if defined(MILLIS_NONE)
+  // Without micros() there's nothing to check the time against later, so
+  // wait here until the new values are in use
+  #if defined(PWM_OVERFLOW_TIMERS)
+  while(pwm_overflow_pending);
+  #endif
+  for(; wait > 1000; wait -= 1000)
+    delayMicroseconds(1000);
+  delayMicroseconds(wait);
+#else
+  pwm_commit_micros = micros();
+  pwm_commit_wait = wait;
+#endif
+}
+
+/* Returns true once the values written by the last pwmCommit() are
+ * guaranteed to be in use by the timers.
+ */
+uint8_t pwmCommitDone(void)
+{
+#if defined(MILLIS_NONE)
+  return 1;
+#else
+  #if defined(PWM_OVERFLOW_TIMERS)
+  if(pwm_overflow_pending)
+    return 0;
+  #endif
+  return (micros() - pwm_commit_micros) >= pwm_commit_wait;
+#endif
+}
@@ -0,0 +1,362 @@
+/* wiring_softpwm.c
+|| Software PWM on any digital pin, driven by the Timer1 compare match B
+|| interrupt
+||
+|| Every channel is switched on at the start of the PWM period, and off
+|| when its duty cycle is reached. The switch off times are kept in a list
+|| sorted by time, where channels on the same port with the same duty cycle
+|| share an entry. Each interrupt handles one point in time, which is a
+|| single PINx write per port on parts that can toggle pins that way, and
+|| sets up the compare match for the next one. The list is only rebuilt
+|| when a duty cycle changes, into a second buffer that the interrupt
+|| switches to at the start of the next period, so a period never mixes
+|| old and new values.
+||
+|| An interrupt takes about 120 clock cycles. Events closer than that are
+|| handled late, so the full 8-bit resolution is only reached with a period
+|| of at least 256 * 120 clock cycles (520 Hz at 16 MHz). Events that are
+|| still left when the period ends are dropped, and the pins stay on until
+|| the next period starts on time.
+||
+|| Timer1 runs in CTC mode with ICR1 as top while the engine runs, so PWM
+|| and input capture on Timer1 don't work meanwhile.
+*/
+
+#include "wiring_private.h"
+#include "pins_arduino.h"
+
+#if defined(TCCR1A) && defined(ICR1) && defined(WGM13) && defined(TIMER1_COMPB_vect)
+
+#if defined(TIMSK1)
+  #define SOFTPWM_TIMSK TIMSK1
+  #define SOFTPWM_TIFR  TIFR1
+#else
+  #define SOFTPWM_TIMSK TIMSK
+  #define SOFTPWM_TIFR  TIFR
+#endif
+
+#if defined(PORTE)
+  #define SOFTPWM_MAX_PORTS 4
+#else
+  #define SOFTPWM_MAX_PORTS 3
+#endif
+
+// Marks the end of the event list
+#define SOFTPWM_END 0xffff
+
+typedef struct
+{
+  uint16_t time;         // Timer count at which the pins are switched off
+  volatile uint8_t *reg; // PINx on parts that toggle a pin by writing to PINx, PORTx otherwise
+  uint8_t mask;
+} softpwm_event_t;
+
+typedef struct
+{
+  volatile uint8_t *out;
+  uint8_t channels; // All software PWM pins on the port
+  uint8_t on;       // Pins with a duty cycle above 0
+} softpwm_port_t;
+
+typedef struct
+{
+  softpwm_port_t ports[SOFTPWM_MAX_PORTS];
+  uint8_t portCount;
+  softpwm_event_t events[SOFTPWM_MAX_CHANNELS + 1];
+} softpwm_list_t;
+
+static uint8_t softpwm_pins[SOFTPWM_MAX_CHANNELS];
+static uint8_t softpwm_duty[SOFTPWM_MAX_CHANNELS];
+static uint8_t softpwm_channel_count;
+
+static softpwm_list_t softpwm_lists[2];
+static volatile uint8_t softpwm_active;  // List used by the interrupt
+static volatile uint8_t softpwm_pending; // Set when the other list is ready to be used
+static const softpwm_event_t *softpwm_next;
+
+static uint8_t softpwm_running;
+static uint8_t saved_tccr1a;
+static uint8_t saved_tccr1b;
+static uint16_t saved_icr1;
+static uint16_t saved_ocr1b;
+
+static void softPwmRebuild(void)
+{
+  // Keep the interrupt from switching to the list while it's being built
+  uint8_t oldSREG = SREG;
+  cli();
+  softpwm_pending = 0;
+  softpwm_list_t *list = &softpwm_lists[softpwm_active ^ 1];
+  SREG = oldSREG;
+
+  uint32_t period = (uint32_t)ICR1 + 1;
+  uint8_t events = 0;
+  list->portCount = 0;
+
+  for(uint8_t i = 0; i < softpwm_channel_count; i++)
+  {
+    uint8_t pin = softpwm_pins[i];
+    uint8_t duty = softpwm_duty[i];
+    uint8_t port = digitalPinToPort(pin);
+    uint8_t mask = digitalPinToBitMask(pin);
+    volatile uint8_t *out = portOutputRegister(port);
+
+    uint8_t p = 0;
+    while(p < list->portCount && list->ports[p].out != out)
+      p++;
+    if(p == list->portCount)
+    {
+      list->ports[p].out = out;
+      list->ports[p].channels = 0;
+      list->ports[p].on = 0;
+      list->portCount++;
+    }
+    list->ports[p].channels |= mask;
+    if(duty)
+      list->ports[p].on |= mask;
+
+    // Always on and always off pins don't need an event
+    if(duty == 0 || duty == 255)
+      continue;
+
+    uint16_t time = ((uint32_t)duty * period) >> 8;
+  #if defined(PINX_TOGGLE)
+    volatile uint8_t *reg = portInputRegister(port);
+  #else
+    volatile uint8_t *reg = out;
+  #endif
+
+    // Insertion sort, sharing the event with a pin on the same port and time
+    uint8_t e = 0;
+    while(e < events && list->events[e].time < time)
+      e++;
+    uint8_t shared = e;
+    while(shared < events && list->events[shared].time == time && list->events[shared].reg != reg)
+      shared++;
+    if(shared < events && list->events[shared].time == time)
+      list->events[shared].mask |= mask;
+    else
+    {
+      for(uint8_t j = events; j > e; j--)
+        list->events[j] = list->events[j - 1];
+      list->events[e].time = time;
+      list->events[e].reg = reg;
+      list->events[e].mask = mask;
+      events++;
+    }
+  }
+  list->events[events].time = SOFTPWM_END;
+
+  oldSREG = SREG;
+  cli();
+  if(softpwm_running)
+    softpwm_pending = 1;
+  else
+    softpwm_active ^= 1;
+  SREG = oldSREG;
+}
+
+/* Starts the software PWM at the given frequency. Returns the actual
+ * frequency, or 0 if it can't be reached.
+ */
+unsigned long softPwmBegin(unsigned long frequency)
+{
+  static const uint16_t prescalers[] = {1, 8, 64, 256, 1024};
+  uint32_t ticks = 0;
+  uint8_t cs = 0;
+
+  softPwmEnd();
+
+  if(frequency == 0)
+    return 0;
+
+  while(cs < 5)
+  {
+    ticks = (F_CPU / prescalers[cs] + frequency / 2) / frequency;
+    if(ticks <= 65536UL)
+      break;
+    cs++;
+  }
+  if(cs == 5 || ticks < 256)
+    return 0;
+
+  uint8_t oldSREG = SREG;
+  cli();
+
+  saved_tccr1a = TCCR1A;
+  saved_tccr1b = TCCR1B;
+  saved_icr1 = ICR1;
+  saved_ocr1b = OCR1B;
+
+  // CTC mode with ICR1 as top. The period starts with a compare match at
+  // 0, and the first one is one timer tick away
+  TCCR1B = 0;
+  TCCR1A = 0;
+  ICR1 = ticks - 1;
+  OCR1B = 0;
+  TCNT1 = ticks - 1;
+  softpwm_next = NULL;
+  softpwm_running = 1;
+  timer1_busy |= TIMER1_BUSY_SOFTPWM;
+
+  SREG = oldSREG;
+
+  // The event times depend on the period
+  softPwmRebuild();
+
+  oldSREG = SREG;
+  cli();
+  SOFTPWM_TIFR = _BV(OCF1B);
+  SOFTPWM_TIMSK |= _BV(OCIE1B);
+  TCCR1B = _BV(WGM13) | _BV(WGM12) | (cs + 1);
+  SREG = oldSREG;
+
+  return F_CPU / prescalers[cs] / ticks;
+}
+
+void softPwmEnd(void)
+{
+  if(!softpwm_running)
+    return;
+
+  uint8_t oldSREG = SREG;
+  cli();
+
+  SOFTPWM_TIMSK &= ~_BV(OCIE1B);
+  TCCR1B = 0;
+  ICR1 = saved_icr1;
+  OCR1B = saved_ocr1b;
+  TCNT1 = 0;
+  TCCR1A = saved_tccr1a;
+  TCCR1B = saved_tccr1b;
+  softpwm_running = 0;
+  timer1_busy &= ~TIMER1_BUSY_SOFTPWM;
+
+  // Leave all pins low
+  const softpwm_list_t *list = &softpwm_lists[softpwm_active];
+  for(uint8_t p = 0; p < list->portCount; p++)
+    *list->ports[p].out &= ~list->ports[p].channels;
+
+  SREG = oldSREG;
+}
+
+/* Sets the duty cycle of a pin from 0 (always off) to 255 (always on). The
+ * pin is added to the software PWM channels the first time.
+ */
+void softPwmWrite(uint8_t pin, uint8_t value)
+{
+  if(digitalPinToPort(pin) == NOT_A_PIN)
+    return;
+
+  uint8_t i = 0;
+  while(i < softpwm_channel_count && softpwm_pins[i] != pin)
+    i++;
+
+  if(i == softpwm_channel_count)
+  {
+    if(softpwm_channel_count == SOFTPWM_MAX_CHANNELS)
+      return;
+    // Disconnect a hardware PWM output, which would override the pin
+    uint8_t timer = digitalPinToTimer(pin);
+    if(timer != NOT_ON_TIMER && timerPwmActive(timer))
+      turnOffPWM(timer);
+
+    softpwm_pins[i] = pin;
+    softpwm_channel_count++;
+    pinMode(pin, OUTPUT);
+  }
+  else if(softpwm_duty[i] == value)
+    return;
+
+  softpwm_duty[i] = value;
+  softPwmRebuild();
+}
+
+// Start of the period. Switches to a new list, turns all pins with a duty
+// cycle above 0 on, and returns the first event of the list. The flags are
+// cleared, so a compare match at 0 that's already pending doesn't handle the
+// first event early, and ICF1 tells when the timer passes top again
+static inline const softpwm_event_t *softPwmPeriodStart(void)
+{
+  uint8_t active = softpwm_active;
+  if(softpwm_pending)
+  {
+    active ^= 1;
+    softpwm_active = active;
+    softpwm_pending = 0;
+  }
+
+  const softpwm_list_t *list = &softpwm_lists[active];
+  const softpwm_port_t *port = list->ports;
+  for(uint8_t p = list->portCount; p; p--, port++)
+    *port->out = (*port->out & ~port->channels) | port->on;
+
+  SOFTPWM_TIFR = _BV(ICF1) | _BV(OCF1B);
+  return list->events;
+}
+
+ISR(TIMER1_COMPB_vect)
+{
+  const softpwm_event_t *event = softpwm_next;
+
+  // CTC mode sets ICF1 when the timer reaches top. If it's set, the period
+  // ended before this interrupt got to run, and what's left of the old list
+  // is dropped. Toggling those pins in the new period would turn them on
+  if(event == NULL || (SOFTPWM_TIFR & _BV(ICF1)))
+    event = softPwmPeriodStart();
+  else
+  {
+    uint16_t time = event->time;
+    do
+    {
+    #if defined(PINX_TOGGLE)
+      *event->reg = event->mask;
+    #else
+      *event->reg &= ~event->mask;
+    #endif
+      event++;
+    } while(event->time == time);
+  }
+
+  // Set up the next compare match. Events that are already due are handled
+  // right away, since their compare match has passed. Handling them can take
+  // the timer past top, which the count can't tell, so ICF1 is checked after
+  // reading it, the same way micros() checks for an overflow
+  for(;;)
+  {
+    uint16_t time = event->time;
+    OCR1B = time == SOFTPWM_END ? 0 : time;
+    uint16_t count = TCNT1;
+
+    if(SOFTPWM_TIFR & _BV(ICF1))
+    {
+      // The new period has started, and its compare match at 0 may have
+      // passed already. Start it right away instead
+      event = softPwmPeriodStart();
+      continue;
+    }
+
+    if(time == SOFTPWM_END)
+    {
+      event = NULL;
+      break;
+    }
+    if(count < time)
+      break;
+
+    SOFTPWM_TIFR = _BV(OCF1B);
+    do
+    {
+    #if defined(PINX_TOGGLE)
+      *event->reg = event->mask;
+    #else
+      *event->reg &= ~event->mask;
+    #endif
+      event++;
+    } while(event->time == time);
+  }
+
+  softpwm_next = event;
+}
+
+#endif
@@ -0,0 +1,270 @@
+/* wiring_synth.c
+|| Wavetable synthesizer with four mixed voices on Timer2
+||
+|| Timer2 runs in fast PWM mode at F_CPU / 256 (62.5 kHz at 16 MHz) on the
+|| OC2A or OC2B pin, and the overflow interrupt in wiring_synth.S computes a
+|| new duty cycle every other period. A low-pass filter on the pin, or just
+|| a speaker, turns it into an analog signal.
+||
+|| Each voice reads one period of a waveform from a 256 byte table in flash
+|| at a rate set by its phase increment, and is scaled by its amplitude.
+|| The voices are summed, so the amplitudes should add up to 255 at most to
+|| avoid clipping. Custom waveforms have to be declared with SYNTH_WAVETABLE,
+|| which aligns them to 256 bytes in flash.
+||
+|| tone() and analogWrite() on the Timer2 pins don't work while the
+|| synthesizer runs.
+*/
+
+#include "wiring_private.h"
+#include "pins_arduino.h"
+
+// Timer2 is taken by millis() in the Timer2 millis modes
+#if defined(TIMER2_OVF_vect) && (defined(OCR2A) || defined(OCR2)) \
+  && !defined(MILLIS_TIMER2) && !defined(MILLIS_TIMER2_ASYNC)
+
+#if defined(TIMSK2)
+  #define SYNTH_TIMSK TIMSK2
+  #define SYNTH_TIFR  TIFR2
+#else
+  #define SYNTH_TIMSK TIMSK
+  #define SYNTH_TIFR  TIFR
+#endif
+
+// Samples per second. Every other Timer2 overflow computes a sample
+#define SYNTH_SAMPLE_RATE (F_CPU / 512)
+
+// Must match the offsets in wiring_synth.S
+typedef struct
+{
+  uint16_t phase;
+  uint16_t increment; // Added to the phase every sample
+  uint8_t page;       // High byte of the wavetable address
+  uint8_t amplitude;
+} synth_voice_t;
+
+// Defined in wiring_synth.S, which makes sure the interrupt is linked in
+extern volatile synth_voice_t synth_voices[SYNTH_VOICES];
+extern volatile uint8_t synth_divider;
+
+// One period of a sine wave
+const int8_t synth_sine[256] SYNTH_WAVETABLE =
+{
+     0,    3,    6,    9,   12,   16,   19,   22,   25,   28,   31,   34,   37,   40,   43,   46,
+    49,   51,   54,   57,   60,   63,   65,   68,   71,   73,   76,   78,   81,   83,   85,   88,
+    90,   92,   94,   96,   98,  100,  102,  104,  106,  107,  109,  111,  112,  113,  115,  116,
+   117,  118,  120,  121,  122,  122,  123,  124,  125,  125,  126,  126,  126,  127,  127,  127,
+   127,  127,  127,  127,  126,  126,  126,  125,  125,  124,  123,  122,  122,  121,  120,  118,
+   117,  116,  115,  113,  112,  111,  109,  107,  106,  104,  102,  100,   98,   96,   94,   92,
+    90,   88,   85,   83,   81,   78,   76,   73,   71,   68,   65,   63,   60,   57,   54,   51,
+    49,   46,   43,   40,   37,   34,   31,   28,   25,   22,   19,   16,   12,    9,    6,    3,
+     0,   -3,   -6,   -9,  -12,  -16,  -19,  -22,  -25,  -28,  -31,  -34,  -37,  -40,  -43,  -46,
+   -49,  -51,  -54,  -57,  -60,  -63,  -65,  -68,  -71,  -73,  -76,  -78,  -81,  -83,  -85,  -88,
+   -90,  -92,  -94,  -96,  -98, -100, -102, -104, -106, -107, -109, -111, -112, -113, -115, -116,
+  -117, -118, -120, -121, -122, -122, -123, -124, -125, -125, -126, -126, -126, -127, -127, -127,
+  -127, -127, -127, -127, -126, -126, -126, -125, -125, -124, -123, -122, -122, -121, -120, -118,
+  -117, -116, -115, -113, -112, -111, -109, -107, -106, -104, -102, -100,  -98,  -96,  -94,  -92,
+   -90,  -88,  -85,  -83,  -81,  -78,  -76,  -73,  -71,  -68,  -65,  -63,  -60,  -57,  -54,  -51,
+   -49,  -46,  -43,  -40,  -37,  -34,  -31,  -28,  -25,  -22,  -19,  -16,  -12,   -9,   -6,   -3
+};
+
+// Triangle wave, in phase with the sine
+const int8_t synth_triangle[256] SYNTH_WAVETABLE =
+{
+     0,    2,    4,    6,    8,   10,   12,   14,   16,   18,   20,   22,   24,   26,   28,   30,
+    32,   34,   36,   38,   40,   42,   44,   46,   48,   50,   52,   54,   56,   58,   60,   62,
+    64,   65,   67,   69,   71,   73,   75,   77,   79,   81,   83,   85,   87,   89,   91,   93,
+    95,   97,   99,  101,  103,  105,  107,  109,  111,  113,  115,  117,  119,  121,  123,  125,
+   127,  125,  123,  121,  119,  117,  115,  113,  111,  109,  107,  105,  103,  101,   99,   97,
+    95,   93,   91,   89,   87,   85,   83,   81,   79,   77,   75,   73,   71,   69,   67,   65,
+    64,   62,   60,   58,   56,   54,   52,   50,   48,   46,   44,   42,   40,   38,   36,   34,
+    32,   30,   28,   26,   24,   22,   20,   18,   16,   14,   12,   10,    8,    6,    4,    2,
+     0,   -2,   -4,   -6,   -8,  -10,  -12,  -14,  -16,  -18,  -20,  -22,  -24,  -26,  -28,  -30,
+   -32,  -34,  -36,  -38,  -40,  -42,  -44,  -46,  -48,  -50,  -52,  -54,  -56,  -58,  -60,  -62,
+   -64,  -65,  -67,  -69,  -71,  -73,  -75,  -77,  -79,  -81,  -83,  -85,  -87,  -89,  -91,  -93,
+   -95,  -97,  -99, -101, -103, -105, -107, -109, -111, -113, -115, -117, -119, -121, -123, -125,
+  -127, -125, -123, -121, -119, -117, -115, -113, -111, -109, -107, -105, -103, -101,  -99,  -97,
+   -95,  -93,  -91,  -89,  -87,  -85,  -83,  -81,  -79,  -77,  -75,  -73,  -71,  -69,  -67,  -65,
+   -64,  -62,  -60,  -58,  -56,  -54,  -52,  -50,  -48,  -46,  -44,  -42,  -40,  -38,  -36,  -34,
+   -32,  -30,  -28,  -26,  -24,  -22,  -20,  -18,  -16,  -14,  -12,  -10,   -8,   -6,   -4,   -2
+};
+
+// Rising sawtooth
+const int8_t synth_sawtooth[256] SYNTH_WAVETABLE =
+{
+  -127, -126, -125, -124, -123, -122, -121, -120, -119, -118, -117, -116, -115, -114, -113, -112,
+  -111, -110, -109, -108, -107, -106, -105, -104, -103, -102, -101, -100,  -99,  -98,  -97,  -96,
+   -95,  -94,  -93,  -92,  -91,  -90,  -89,  -88,  -87,  -86,  -85,  -84,  -83,  -82,  -81,  -80,
+   -79,  -78,  -77,  -76,  -75,  -74,  -73,  -72,  -71,  -70,  -69,  -68,  -67,  -66,  -65,  -64,
+   -63,  -62,  -61,  -60,  -59,  -58,  -57,  -56,  -55,  -54,  -53,  -52,  -51,  -50,  -49,  -48,
+   -47,  -46,  -45,  -44,  -43,  -42,  -41,  -40,  -39,  -38,  -37,  -36,  -35,  -34,  -33,  -32,
+   -31,  -30,  -29,  -28,  -27,  -26,  -25,  -24,  -23,  -22,  -21,  -20,  -19,  -18,  -17,  -16,
+   -15,  -14,  -13,  -12,  -11,  -10,   -9,   -8,   -7,   -6,   -5,   -4,   -3,   -2,   -1,    0,
+     0,    1,    2,    3,    4,    5,    6,    7,    8,    9,   10,   11,   12,   13,   14,   15,
+    16,   17,   18,   19,   20,   21,   22,   23,   24,   25,   26,   27,   28,   29,   30,   31,
+    32,   33,   34,   35,   36,   37,   38,   39,   40,   41,   42,   43,   44,   45,   46,   47,
+    48,   49,   50,   51,   52,   53,   54,   55,   56,   57,   58,   59,   60,   61,   62,   63,
+    64,   65,   66,   67,   68,   69,   70,   71,   72,   73,   74,   75,   76,   77,   78,   79,
+    80,   81,   82,   83,   84,   85,   86,   87,   88,   89,   90,   91,   92,   93,   94,   95,
+    96,   97,   98,   99,  100,  101,  102,  103,  104,  105,  106,  107,  108,  109,  110,  111,
+   112,  113,  114,  115,  116,  117,  118,  119,  120,  121,  122,  123,  124,  125,  126,  127
+};
+
+// Square wave with 50% duty cycle
+const int8_t synth_square[256] SYNTH_WAVETABLE =
+{
+   127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,
+   127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,
+   127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,
+   127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,
+   127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,
+   127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,
+   127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,
+   127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,
+  -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127,
+  -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127,
+  -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127,
+  -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127,
+  -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127,
+  -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127,
+  -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127,
+  -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127
+};
+
+static uint8_t synth_timer;
+#if defined(TCCR2A)
+static uint8_t saved_tccr2a;
+static uint8_t saved_tccr2b;
+static uint8_t saved_ocr2a;
+static uint8_t saved_ocr2b;
+#else
+static uint8_t saved_tccr2;
+static uint8_t saved_ocr2;
+#endif
+
+/* Starts the synthesizer on a Timer2 PWM pin, with all voices silent.
+ * Returns the sample rate, or 0 if the pin isn't a Timer2 output.
+ */
+unsigned long synthBegin(uint8_t pin)
+{
+  uint8_t timer = digitalPinToTimer(pin);
+  if(timer != TIMER2 && timer != TIMER2A && timer != TIMER2B)
+    return 0;
+
+  synthEnd();
+  pinMode(pin, OUTPUT);
+
+  uint8_t oldSREG = SREG;
+  cli();
+
+  for(uint8_t i = 0; i < SYNTH_VOICES; i++)
+  {
+    synth_voices[i].phase = 0;
+    synth_voices[i].increment = 0;
+    synth_voices[i].page = (uint16_t)synth_sine >> 8;
+    synth_voices[i].amplitude = 0;
+  }
+  synth_divider = 0x0f;
+
+  // Fast PWM without prescaler, starting at the midpoint
+#if defined(TCCR2A)
+  saved_tccr2a = TCCR2A;
+  saved_tccr2b = TCCR2B;
+  saved_ocr2a = OCR2A;
+  saved_ocr2b = OCR2B;
+  TCCR2B = 0;
+  TCCR2A = _BV(WGM21) | _BV(WGM20) | (timer == TIMER2B ? _BV(COM2B1) : _BV(COM2A1));
+  OCR2A = 0x80;
+  OCR2B = 0x80;
+  TCNT2 = 0;
+  SYNTH_TIFR = _BV(TOV2);
+  SYNTH_TIMSK |= _BV(TOIE2);
+  TCCR2B = _BV(CS20);
+#else
+  saved_tccr2 = TCCR2;
+  saved_ocr2 = OCR2;
+  TCCR2 = 0;
+  OCR2 = 0x80;
+  TCNT2 = 0;
+  SYNTH_TIFR = _BV(TOV2);
+  SYNTH_TIMSK |= _BV(TOIE2);
+  TCCR2 = _BV(WGM21) | _BV(WGM20) | _BV(COM21) | _BV(CS20);
+#endif
+  synth_timer = timer;
+
+  SREG = oldSREG;
+
+  return SYNTH_SAMPLE_RATE;
+}
+
+/* Stops the synthesizer, and gives Timer2 its previous settings back */
+void synthEnd(void)
+{
+  if(!synth_timer)
+    return;
+
+  uint8_t oldSREG = SREG;
+  cli();
+
+  SYNTH_TIMSK &= ~_BV(TOIE2);
+#if defined(TCCR2A)
+  TCCR2B = 0;
+  OCR2A = saved_ocr2a;
+  OCR2B = saved_ocr2b;
+  TCNT2 = 0;
+  TCCR2A = saved_tccr2a;
+  TCCR2B = saved_tccr2b;
+#else
+  TCCR2 = 0;
+  OCR2 = saved_ocr2;
+  TCNT2 = 0;
+  TCCR2 = saved_tccr2;
+#endif
+  synth_timer = 0;
+
+  SREG = oldSREG;
+}
+
+/* Sets the waveform, frequency and amplitude (0 to 255) of a voice. The
+ * waveform is one of the built-in tables or a table declared with
+ * SYNTH_WAVETABLE. Frequencies up to half the sample rate can be played,
+ * in steps of the sample rate / 65536 (about 0.5 Hz at 16 MHz).
+ */
+void synthVoice(uint8_t voice, const int8_t *wavetable, unsigned int frequency, uint8_t amplitude)
+{
+  if(voice >= SYNTH_VOICES)
+    return;
+
+  uint8_t oldSREG = SREG;
+  cli();
+  synth_voices[voice].page = (uint16_t)wavetable >> 8;
+  SREG = oldSREG;
+
+  synthFrequency(voice, frequency);
+  synthAmplitude(voice, amplitude);
+}
+
+void synthFrequency(uint8_t voice, unsigned int frequency)
+{
+  if(voice >= SYNTH_VOICES)
+    return;
+  if(frequency > SYNTH_SAMPLE_RATE / 2)
+    frequency = SYNTH_SAMPLE_RATE / 2;
+
+  uint16_t increment = (((uint32_t)frequency << 16) + SYNTH_SAMPLE_RATE / 2) / SYNTH_SAMPLE_RATE;
+
+  uint8_t oldSREG = SREG;
+  cli();
+  synth_voices[voice].increment = increment;
+  SREG = oldSREG;
+}
+
+void synthAmplitude(uint8_t voice, uint8_t amplitude)
+{
+  if(voice >= SYNTH_VOICES)
+    return;
+
+  synth_voices[voice].amplitude = amplitude;
+}
+
+#endif
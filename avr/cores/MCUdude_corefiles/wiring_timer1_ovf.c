@@ -0,0 +1,25 @@
+/* wiring_timer1_ovf.c
+|| Shared Timer1 overflow interrupt
+||
+|| The input capture functions and the cycle counter both extend the Timer1
+|| count with its overflows, and install their handler in timer1_ovf_handler.
+|| The interrupt lives in its own file, so it's only linked when one of them
+|| is used.
+*/
+
+#include "wiring_private.h"
+
+#if defined(TIMER1_OVF_vect)
+
+static void timer1OvfNoHandler(void)
+{
+}
+
+volatile voidFuncPtr timer1_ovf_handler = timer1OvfNoHandler;
+
+ISR(TIMER1_OVF_vect)
+{
+  timer1_ovf_handler();
+}
+
+#endif
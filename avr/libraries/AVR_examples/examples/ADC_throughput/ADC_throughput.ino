@@ -0,0 +1,59 @@
+/*************************************************************
+ This sketch measures how many analogRead() calls per second
+ can be done with different ADC clock prescalers, in 10-bit
+ and 8-bit mode.
+ analogReadSpeed() sets the ADC clock prescaler. The default
+ keeps the ADC clock within 50 - 200 kHz, which is required
+ for full 10-bit accuracy. A faster ADC clock (up to around
+ 1 MHz) still gives good 8-bit results.
+ analogReadResolution(8) left adjusts the result, so only
+ one byte has to be read from the ADC.
+ Connect a potentiometer or another voltage source to A0.
+ The results are printed to the serial monitor.
+**************************************************************/
+
+#define NUMBER_OF_READS 1000
+
+void measure(uint8_t bits, uint8_t prescaler)
+{
+  analogReadResolution(bits);
+  analogReadSpeed(prescaler);
+  analogRead(A0); // The first conversion after a change may be off
+
+  uint32_t sum = 0;
+  uint32_t start = micros();
+  for(uint16_t i = 0; i < NUMBER_OF_READS; i++)
+    sum += analogRead(A0);
+  uint32_t elapsed = micros() - start;
+
+  Serial.print(bits);
+  Serial.print(F("-bit, F_CPU/"));
+  Serial.print(prescaler);
+  Serial.print(F(": "));
+  Serial.print(NUMBER_OF_READS * 1000000UL / elapsed);
+  Serial.print(F(" samples per second, average reading "));
+  Serial.println(sum / NUMBER_OF_READS);
+}
+
+void setup()
+{
+  Serial.begin(9600);
+
+  const uint8_t prescalers[] = {128, 64, 32, 16, 8};
+  for(uint8_t i = 0; i < sizeof(prescalers); i++)
+  {
+    // An ADC clock above 1 MHz is out of spec
+    if(F_CPU / prescalers[i] > 1000000UL)
+      continue;
+    measure(10, prescalers[i]);
+    measure(8, prescalers[i]);
+  }
+
+  // Back to the defaults
+  analogReadResolution(10);
+  analogReadSpeed(F_CPU >= 16000000UL ? 128 : F_CPU >= 8000000UL ? 64 : F_CPU >= 4000000UL ? 32 : F_CPU >= 2000000UL ? 16 : 8);
+}
+
+void loop()
+{
+}
@@ -0,0 +1,53 @@
+/**************************************************************
+ This sketch uses the analog comparator to detect when the
+ voltage on AIN0 (PD6, Arduino pin 6) crosses the voltage on
+ A0, e.g. a zero-crossing detector or an overcurrent trip
+ level set by a potentiometer on A0.
+ The comparator reacts within a few hundred nanoseconds, and
+ the edges are counted in the comparator interrupt without
+ polling analogRead(). The comparator output is also routed
+ to the Timer1 input capture unit, so the length of the time
+ AIN0 stays above A0 is measured with a resolution of one
+ clock cycle, and printed in microseconds.
+ Note that analogRead() can't be used while A0 is selected as
+ the negative input, since the ADC has to be turned off.
+ The results are printed on the serial monitor.
+ **************************************************************/
+
+volatile uint16_t risingEdges;
+
+void countEdge()
+{
+  risingEdges++;
+}
+
+void setup()
+{
+  Serial.begin(9600);
+
+  analogComparatorBegin(ANALOG_COMPARATOR_AIN0, A0);
+  analogComparatorAttachInterrupt(countEdge, RISING);
+  analogComparatorInputCapture(true);
+}
+
+void loop()
+{
+  // The output is high while AIN0 is above A0
+  unsigned long highTime = pulseInCapture(HIGH, 100000);
+
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t edges = risingEdges;
+  risingEdges = 0;
+  SREG = oldSREG;
+
+  Serial.print(F("Output: "));
+  Serial.print(analogComparatorRead());
+  Serial.print(F(", rising edges: "));
+  Serial.print(edges);
+  Serial.print(F(", high time: "));
+  Serial.print(highTime);
+  Serial.println(F(" us"));
+
+  delay(1000);
+}
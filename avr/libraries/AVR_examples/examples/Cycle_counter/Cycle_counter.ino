@@ -0,0 +1,33 @@
+/**************************************************************
+ This sketch times a piece of code with the 64-bit cycle
+ counter on Timer1, and prints the time since start-up with
+ micros64(), which doesn't wrap like micros() does after
+ about 71 minutes.
+ cycleTicks() only reads the timer, so it's cheap enough to
+ timestamp code without disturbing what's being measured.
+ The difference of two readings is the number of clock
+ cycles, including the few cycles cycleTicks() itself takes.
+ Note that PWM on pin 9 and 10 won't work in this sketch,
+ since Timer1 is reconfigured.
+ **************************************************************/
+
+void setup()
+{
+  Serial.begin(9600);
+  cyclesBegin(CYCLES_CLOCK);
+}
+
+void loop()
+{
+  uint32_t start = cycleTicks();
+  volatile float result = sqrt(analogRead(A0));
+  uint32_t cycles = cycleTicks() - start;
+
+  // Print doesn't handle 64-bit numbers, so split it in seconds and microseconds
+  uint64_t us = micros64();
+  Serial.printf("%lu.%06lu s: sqrt() took %lu cycles\n",
+                (uint32_t)(us / 1000000UL), (uint32_t)(us % 1000000UL), cycles);
+  (void)result;
+
+  delay(1000);
+}
@@ -0,0 +1,64 @@
+/*************************************************************
+ This sketch compares the number of clock cycles it takes to
+ set, clear and toggle a pin using the regular Arduino
+ functions and the fast alternatives.
+ Timer1 runs directly from the system clock, so TCNT1 counts
+ clock cycles. The timer is read right before and right after
+ each operation, and the overhead of reading the timer itself
+ is subtracted. Interrupts are disabled while measuring.
+ Note that Timer1 is reconfigured, so analogWrite() on pin
+ 9 and 10 won't work as expected in this sketch.
+ The results are printed to the serial monitor.
+**************************************************************/
+
+#define TEST_PIN PIN_PB5 // Arduino pin 13
+
+uint16_t overhead;
+
+// Returns the number of clock cycles the statement took
+#define CYCLES(statement) ({   \
+  uint8_t oldSREG = SREG;      \
+  cli();                       \
+  uint16_t start = TCNT1;      \
+  statement;                   \
+  uint16_t stop = TCNT1;       \
+  SREG = oldSREG;              \
+  (uint16_t)(stop - start - overhead); })
+
+void printResult(const __FlashStringHelper *name, uint16_t cycles)
+{
+  Serial.print(name);
+  Serial.print(cycles);
+  Serial.println(F(" cycles"));
+}
+
+void setup()
+{
+  Serial.begin(9600);
+
+  TCCR1A = 0;         // Normal mode
+  TCCR1B = _BV(CS10); // Clock timer 1 directly from the system clock
+
+  overhead = 0;
+  overhead = CYCLES();
+
+  pinMode(TEST_PIN, OUTPUT);
+  PinHandle handle(TEST_PIN);
+  // Pin number the compiler can't see through
+  volatile uint8_t runtimePin = TEST_PIN;
+
+  printResult(F("digitalWrite(HIGH):         "), CYCLES(digitalWrite(TEST_PIN, HIGH)));
+  printResult(F("digitalWrite(LOW):          "), CYCLES(digitalWrite(TEST_PIN, LOW)));
+  printResult(F("digitalToggle():            "), CYCLES(digitalToggle(TEST_PIN)));
+  printResult(F("fastDigitalWrite(HIGH):     "), CYCLES(fastDigitalWrite(TEST_PIN, HIGH)));
+  printResult(F("fastDigitalWrite(LOW):      "), CYCLES(fastDigitalWrite(TEST_PIN, LOW)));
+  printResult(F("fastDigitalToggle():        "), CYCLES(fastDigitalToggle(TEST_PIN)));
+  printResult(F("FastPin<>::toggle():        "), CYCLES(FastPin<TEST_PIN>::toggle()));
+  printResult(F("fastDigitalWrite(runtime):  "), CYCLES(fastDigitalWrite(runtimePin, HIGH)));
+  printResult(F("PinHandle::write():         "), CYCLES(handle.write(LOW)));
+  printResult(F("PinHandle::toggle():        "), CYCLES(handle.toggle()));
+}
+
+void loop()
+{
+}
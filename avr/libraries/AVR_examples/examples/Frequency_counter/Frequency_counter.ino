@@ -0,0 +1,123 @@
+/**************************************************************
+ This sketch measures the frequency of a signal connected to
+ the T1 pin (PD5, Arduino pin 5).
+ Timer1 is clocked directly by the rising edges on T1, so the
+ edges are counted in hardware without any CPU time spent per
+ edge. The Timer1 overflow interrupt only fires once every
+ 65536 edges, and extends the count to 32 bits.
+ Timer2 provides the gate time. It interrupts once every
+ millisecond, and after GATE_TIME_MS interrupts the Timer1
+ count is sampled. The counter keeps running between gates,
+ so no edges are lost from one gate to the next.
+ The signal frequency must be less than F_CPU / 2.5
+ (6.4 MHz at 16 MHz). A longer gate time gives a higher
+ resolution: 1 Hz at a 1000 ms gate, 10 Hz at a 100 ms gate.
+ Note that PWM on pin 3, 9, 10 and 11 won't work in this
+ sketch, since Timer1 and Timer2 are reconfigured.
+ The frequency is printed on the serial monitor.
+ **************************************************************/
+
+// Gate time in milliseconds
+#define GATE_TIME_MS 1000
+
+// Timer2 runs at F_CPU/128, and overflows after OCR2_VALUE + 1 ticks
+#define TIMER2_PRESCALER 128UL
+#define OCR2_VALUE ((F_CPU / TIMER2_PRESCALER / 1000UL) - 1)
+
+#if defined(__AVR_ATmega8__)
+  #define TIMER1_INT_REG TIMSK
+  #define TIMER1_FLAG_REG TIFR
+  #define TIMER2_COMPARE_vect TIMER2_COMP_vect
+#else // ATmega48/P, ATmega88/P, ATmega168/P, ATmega328/P/PB
+  #define TIMER1_INT_REG TIMSK1
+  #define TIMER1_FLAG_REG TIFR1
+  #define TIMER2_COMPARE_vect TIMER2_COMPA_vect
+#endif
+
+volatile uint16_t timer1Overflows;
+volatile uint16_t gateTicks;
+volatile uint32_t lastTotal;
+volatile uint32_t gateCount;
+volatile bool newResult;
+
+void setup()
+{
+  Serial.begin(9600);
+
+  pinMode(5, INPUT); // T1 (PD5) is the counter input
+
+  uint8_t oldSREG = SREG;
+  cli();
+
+  // Timer1: normal mode, clocked by rising edges on T1
+  TCCR1A = 0;
+  TCCR1B = _BV(CS12) | _BV(CS11) | _BV(CS10);
+  TCNT1 = 0;
+  TIMER1_FLAG_REG = _BV(TOV1);
+  TIMER1_INT_REG = _BV(TOIE1);
+
+  // Timer2: CTC mode, F_CPU/128, one interrupt every millisecond
+  #if defined(__AVR_ATmega8__)
+    TCCR2 = _BV(WGM21) | _BV(CS22) | _BV(CS20);
+    OCR2 = OCR2_VALUE;
+    TIMSK |= _BV(OCIE2);
+  #else
+    TCCR2A = _BV(WGM21);
+    TCCR2B = _BV(CS22) | _BV(CS20);
+    OCR2A = OCR2_VALUE;
+    TIMSK2 = _BV(OCIE2A);
+  #endif
+
+  SREG = oldSREG;
+}
+
+void loop()
+{
+  static bool firstGate = true;
+
+  if(newResult)
+  {
+    uint8_t oldSREG = SREG;
+    cli();
+    uint32_t count = gateCount;
+    newResult = false;
+    SREG = oldSREG;
+
+    // The first gate starts somewhere in the middle of a Timer2 period
+    if(firstGate)
+    {
+      firstGate = false;
+      return;
+    }
+
+    // The Timer2 period is only exactly one millisecond when F_CPU / 128 is a
+    // multiple of 1000, so compute the frequency from the actual gate time
+    double gateSeconds = (double)GATE_TIME_MS * TIMER2_PRESCALER * (OCR2_VALUE + 1) / F_CPU;
+    Serial.print(count / gateSeconds);
+    Serial.println(F(" Hz"));
+  }
+}
+
+ISR(TIMER1_OVF_vect) // Timer1 overflow, once every 65536 edges
+{
+  timer1Overflows++;
+}
+
+ISR(TIMER2_COMPARE_vect) // Timer2 compare match, once every millisecond
+{
+  if(++gateTicks < GATE_TIME_MS)
+    return;
+  gateTicks = 0;
+
+  uint16_t count = TCNT1;
+  uint16_t overflows = timer1Overflows;
+
+  // An overflow that happened just before TCNT1 was read hasn't been counted yet
+  if((TIMER1_FLAG_REG & _BV(TOV1)) && count < 0x8000)
+    overflows++;
+
+  uint32_t total = ((uint32_t)overflows << 16) | count;
+  gateCount = total - lastTotal;
+  lastTotal = total;
+  newResult = true;
+}
@@ -0,0 +1,44 @@
+/**************************************************************
+ This sketch shows the 16-bit PWM on Timer1 (pin 9 and 10).
+ analogWriteResolution(16) makes analogWrite() take values
+ from 0 to 65535, and switches Timer1 to 16-bit fast PWM at
+ F_CPU / 65536 (244 Hz at 16 MHz). An LED on pin 9 is faded
+ with a gamma curve, which needs the extra resolution to
+ dim smoothly at the low end.
+ pwmSetup() sets Timer1 to a 20 kHz phase correct PWM, for a
+ motor driver on pin 10. The resolution is then given by the
+ timer top value, 400 steps at 16 MHz, and analogWrite()
+ values are scaled to it.
+ Note that both pins share Timer1, so they also share the
+ frequency set by the last call.
+ **************************************************************/
+
+void setup()
+{
+  Serial.begin(9600);
+
+  analogWriteResolution(16);
+
+  // Fade in and out. The brightness is squared for a rough gamma correction
+  for(uint16_t i = 0; i < 512; i++)
+  {
+    uint16_t brightness = (i < 256) ? i : 511 - i;
+    analogWrite(9, brightness * brightness);
+    delay(8);
+  }
+
+  unsigned long frequency = pwmSetup(10, 20000, PWM_PHASE_CORRECT);
+  Serial.print(F("Timer1 PWM frequency: "));
+  Serial.print(frequency);
+  Serial.println(F(" Hz"));
+}
+
+void loop()
+{
+  // Ramp the motor speed from 0 to 100 %
+  for(uint32_t speed = 0; speed <= 65535; speed += 256)
+  {
+    analogWrite(10, speed);
+    delay(20);
+  }
+}
@@ -0,0 +1,84 @@
+/*************************************************************
+ This sketch compares the number of clock cycles it takes to
+ write an 8-bit value to eight pins spread over two ports,
+ like the data bus of an 8080-style parallel LCD or an R-2R
+ DAC, using a digitalWrite() loop, PinBus and FastPinBus.
+ Timer1 runs directly from the system clock, so TCNT1 counts
+ clock cycles. The timer is read right before and right after
+ each write, and the overhead of reading the timer itself
+ is subtracted. Interrupts are disabled while measuring.
+ Note that Timer1 is reconfigured, so analogWrite() on pin
+ 9 and 10 won't work as expected in this sketch.
+ The results are printed to the serial monitor.
+**************************************************************/
+
+// Bus bit 0-3 on PD4-PD7 and bus bit 4-7 on PB0-PB3
+const uint8_t busPins[] = {PIN_PD4, PIN_PD5, PIN_PD6, PIN_PD7, PIN_PB0, PIN_PB1, PIN_PB2, PIN_PB3};
+
+PinBus bus(busPins, sizeof(busPins));
+FastPinBus<PIN_PD4, PIN_PD5, PIN_PD6, PIN_PD7, PIN_PB0, PIN_PB1, PIN_PB2, PIN_PB3> fastBus;
+
+uint16_t overhead;
+
+// Returns the number of clock cycles the statement took
+#define CYCLES(statement) ({   \
+  uint8_t oldSREG = SREG;      \
+  cli();                       \
+  uint16_t start = TCNT1;      \
+  statement;                   \
+  uint16_t stop = TCNT1;       \
+  SREG = oldSREG;              \
+  (uint16_t)(stop - start - overhead); })
+
+void digitalWriteBus(uint8_t value)
+{
+  for(uint8_t i = 0; i < sizeof(busPins); i++)
+    digitalWrite(busPins[i], (value >> i) & 0x01);
+}
+
+void printResult(const __FlashStringHelper *name, uint16_t cycles)
+{
+  Serial.print(name);
+  Serial.print(cycles);
+  Serial.println(F(" cycles"));
+}
+
+void setup()
+{
+  Serial.begin(9600);
+
+  TCCR1A = 0;         // Normal mode
+  TCCR1B = _BV(CS10); // Clock timer 1 directly from the system clock
+
+  overhead = 0;
+  overhead = CYCLES();
+
+  bus.mode(OUTPUT);
+
+  // Value the compiler can't see through
+  volatile uint8_t value = 0xa5;
+
+  printResult(F("digitalWrite() loop:  "), CYCLES(digitalWriteBus(value)));
+  printResult(F("PinBus::write():      "), CYCLES(bus.write(value)));
+  printResult(F("FastPinBus::write():  "), CYCLES(fastBus.write(value)));
+
+  // Check that all three produce the same pin states
+  digitalWriteBus(value);
+  uint16_t a = bus.read();
+  bus.write(~value);
+  bus.write(value);
+  uint16_t b = bus.read();
+  fastBus.write(~value);
+  fastBus.write(value);
+  uint16_t c = fastBus.read();
+  Serial.print(F("Read back: 0x"));
+  Serial.print(a, HEX);
+  Serial.print(F(" 0x"));
+  Serial.print(b, HEX);
+  Serial.print(F(" 0x"));
+  Serial.println(c, HEX);
+}
+
+void loop()
+{
+}
@@ -0,0 +1,45 @@
+/**************************************************************
+ This sketch drives 12 LEDs with software PWM, on pins that
+ mostly don't have a hardware PWM output.
+ The software PWM engine uses the Timer1 compare match B
+ interrupt. Only one interrupt fires for every distinct duty
+ cycle in a period, and the list of events is only rebuilt
+ when a duty cycle changes. The LEDs show a running wave,
+ where every LED has its own brightness.
+ Note that PWM on pin 9 and 10 won't work in this sketch,
+ since Timer1 is reconfigured.
+ **************************************************************/
+
+const uint8_t ledPins[] = {2, 3, 4, 5, 6, 7, 8, 11, 12, 13, A0, A1};
+const uint8_t ledCount = sizeof(ledPins) / sizeof(ledPins[0]);
+
+// A quarter of a sine wave
+const uint8_t brightness[] = {0, 2, 8, 18, 32, 50, 72, 98, 128, 161, 197, 236, 255};
+
+uint8_t position = 0;
+
+void setup()
+{
+  Serial.begin(9600);
+
+  unsigned long frequency = softPwmBegin(200);
+  Serial.print(F("Software PWM frequency: "));
+  Serial.print(frequency);
+  Serial.println(F(" Hz"));
+}
+
+void loop()
+{
+  for(uint8_t i = 0; i < ledCount; i++)
+  {
+    // Triangle from 0 to 12 and back, shifted for every LED
+    uint8_t step = (position + 2 * i) % 24;
+    if(step > 12)
+      step = 24 - step;
+    softPwmWrite(ledPins[i], brightness[step]);
+  }
+
+  if(++position == 24)
+    position = 0;
+  delay(40);
+}
@@ -0,0 +1,74 @@
+/**************************************************************
+ This sketch plays a chord and a two tone alert on pin 11,
+ using the wavetable synthesizer on Timer2.
+ Connect a small speaker through a 100 ohm resistor, or an RC
+ low-pass filter (1k and 100nF) to view the signal on a scope.
+ Four voices play at the same time, each with its own
+ waveform and amplitude. The amplitudes of the voices playing
+ at once should add up to 255 at most.
+ The last waveform is a custom one, stored in flash with
+ SYNTH_WAVETABLE so it's aligned the way the synthesizer
+ needs it.
+ Note that PWM on pin 3 and 11, and tone() won't work in this
+ sketch, since Timer2 is reconfigured.
+ **************************************************************/
+
+// A sine with its third harmonic, for a slightly hollow sound
+const int8_t hollow[256] SYNTH_WAVETABLE =
+{
+     0,    7,   13,   20,   26,   33,   39,   45,   51,   57,   63,   68,   74,   79,   84,   89,
+    93,   97,  101,  105,  108,  111,  114,  117,  119,  121,  123,  124,  125,  126,  127,  127,
+   127,  127,  127,  126,  125,  124,  123,  122,  121,  119,  118,  116,  114,  113,  111,  109,
+   107,  105,  104,  102,  100,   99,   97,   96,   95,   94,   93,   92,   91,   91,   90,   90,
+    90,   90,   90,   91,   91,   92,   93,   94,   95,   96,   97,   99,  100,  102,  104,  105,
+   107,  109,  111,  113,  114,  116,  118,  119,  121,  122,  123,  124,  125,  126,  127,  127,
+   127,  127,  127,  126,  125,  124,  123,  121,  119,  117,  114,  111,  108,  105,  101,   97,
+    93,   89,   84,   79,   74,   68,   63,   57,   51,   45,   39,   33,   26,   20,   13,    7,
+     0,   -7,  -13,  -20,  -26,  -33,  -39,  -45,  -51,  -57,  -63,  -68,  -74,  -79,  -84,  -89,
+   -93,  -97, -101, -105, -108, -111, -114, -117, -119, -121, -123, -124, -125, -126, -127, -127,
+  -127, -127, -127, -126, -125, -124, -123, -122, -121, -119, -118, -116, -114, -113, -111, -109,
+  -107, -105, -104, -102, -100,  -99,  -97,  -96,  -95,  -94,  -93,  -92,  -91,  -91,  -90,  -90,
+   -90,  -90,  -90,  -91,  -91,  -92,  -93,  -94,  -95,  -96,  -97,  -99, -100, -102, -104, -105,
+  -107, -109, -111, -113, -114, -116, -118, -119, -121, -122, -123, -124, -125, -126, -127, -127,
+  -127, -127, -127, -126, -125, -124, -123, -121, -119, -117, -114, -111, -108, -105, -101,  -97,
+   -93,  -89,  -84,  -79,  -74,  -68,  -63,  -57,  -51,  -45,  -39,  -33,  -26,  -20,  -13,   -7
+};
+
+void setup()
+{
+  Serial.begin(9600);
+
+  unsigned long sampleRate = synthBegin(11);
+  Serial.print(F("Sample rate: "));
+  Serial.print(sampleRate);
+  Serial.println(F(" Hz"));
+}
+
+void loop()
+{
+  // C major chord, fading out
+  synthVoice(0, synth_sine, 262, 0);
+  synthVoice(1, synth_triangle, 330, 0);
+  synthVoice(2, synth_sine, 392, 0);
+  synthVoice(3, hollow, 131, 0);
+  for(int16_t level = 63; level >= 0; level--)
+  {
+    for(uint8_t voice = 0; voice < SYNTH_VOICES; voice++)
+      synthAmplitude(voice, level);
+    delay(30);
+  }
+
+  delay(500);
+
+  // Two tone alert on a single voice
+  for(uint8_t i = 0; i < 4; i++)
+  {
+    synthVoice(0, synth_square, 880, 160);
+    delay(200);
+    synthFrequency(0, 660);
+    delay(200);
+  }
+  synthAmplitude(0, 0);
+
+  delay(1000);
+}